@@ -0,0 +1,186 @@
+// read throughput benchmark for the sharded tracker metadata store
+// runs list_files / download_file style lookups (same locking as the tracker
+// handlers) from 1..N threads, with an optional share of file_downloaded
+// style writes, and prints ops/sec per thread count
+//
+// g++ -O2 -o metastore_bench metastore_bench.cpp -lpthread
+// ./metastore_bench [max_threads] [seconds] [write_percent]
+
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../tracker/metastore.h"
+
+using namespace std;
+
+const int NUM_GROUPS = 256;         // groups in store
+const int FILES_PER_GROUP = 32;     // files per group
+const int PIECES_PER_FILE = 64;     // piece hashes per file
+const int USERS_PER_GROUP = 8;      // members per group
+
+metastore store;
+
+string username(int g, int u) { return "user" + to_string(g) + "_" + to_string(u); }
+string groupname(int g) { return "group" + to_string(g); }
+string filename(int g, int f) { return "file" + to_string(g) + "_" + to_string(f); }
+string contenthash(int g, int f) { return "hash" + to_string(g) + "_" + to_string(f); }
+
+// ids the way a command gets them, one name lookup each
+nameid userid(int g, int u) { return store.usernames.find(username(g, u)); }
+nameid groupid(int g) { return store.groupnames.find(groupname(g)); }
+nameid fileid(int g, int f) { return store.filenames.find(filename(g, f)); }
+nameid contentid(int g, int f) { return store.contents.find(contenthash(g, f)); }
+
+// filling store with groups, members, files and seeders
+void populate()
+{
+    for (int g = 0; g < NUM_GROUPS; g++)
+    {
+        groupentry ge;
+        ge.grp = make_unique<group>(store.usernames.intern(username(g, 0)));
+        for (int u = 0; u < USERS_PER_GROUP; u++)
+        {
+            nameid uid = store.usernames.intern(username(g, u));
+            unique_ptr<client> c = make_unique<client>("pass");
+            string ip = "127.0.0.1", port = to_string(10000 + u);
+            c->login(ip, port);
+            store.peers.insert(uid, move(c));
+            ge.grp->participants.insert(uid);
+        }
+        for (int f = 0; f < FILES_PER_GROUP; f++)
+        {
+            nameid cid = store.contents.intern(contenthash(g, f));
+            ge.addfile(store.filenames.intern(filename(g, f)), cid, store.filenames);
+            store.files.upsert(cid, [&](FileMeta &fm)
+            {
+                fm.size = (long long)PIECES_PER_FILE * 512 * 1024;
+                fm.fullhash = contenthash(g, f);
+                fm.num_pieces = PIECES_PER_FILE;
+                fm.piece_hashes.assign(PIECES_PER_FILE, sha1digest());
+                for (int u = 0; u < USERS_PER_GROUP; u += 2)
+                {
+                    nameid uid = userid(g, u);
+                    fm.peers.insert(uid);
+                    store.peers.read(uid, [&](client *c) { fm.online[uid] = seederaddr{c, c->hostip, c->hostport}; });
+                }
+            });
+        }
+        store.groups.insert(store.groupnames.intern(groupname(g)), move(ge));
+    }
+}
+
+// list_files lookup, returns reply size
+size_t listfiles(nameid gid, nameid uid)
+{
+    string msg;
+    store.groups.read(gid, [&](groupentry &ge)
+    {
+        if (!ge.grp->partofgroup(uid)) return;
+        for (auto &it : ge.files)
+        {
+            store.files.read(it.second, [&](FileMeta &fm)
+            {
+                msg += string(store.filenames.name(it.first)) + " SIZE:" + to_string(fm.size) + " PIECES:" + to_string(fm.num_pieces) + "\n";
+            });
+        }
+    });
+    return msg.size();
+}
+
+// download_file lookup, returns reply size
+size_t downloadfile(nameid gid, nameid fid, nameid uid)
+{
+    nameid cid = NOID;
+    store.groups.read(gid, [&](groupentry &ge)
+    {
+        if (ge.grp->partofgroup(uid)) cid = ge.contentof(fid);
+    });
+    if (cid == NOID) return 0;
+
+    string msg;
+    store.files.read(cid, [&](FileMeta &fm)
+    {
+        msg = "FILE " + string(store.filenames.name(fid)) + " SIZE " + to_string(fm.size) + " HASH " + fm.fullhash + " PIECES " + to_string(fm.num_pieces) + " PIECE_HASHES";
+        for (auto &h : fm.piece_hashes) msg += " " + digesttohex(h);
+        msg += "\nPEERS\n";
+        for (auto &it : fm.online) msg += string(store.usernames.name(it.first)) + " " + it.second.ip + " " + it.second.port + "\n";
+    });
+    return msg.size();
+}
+
+// file_downloaded style write
+void filedownloaded(nameid cid, nameid uid)
+{
+    seederaddr addr;
+    store.peers.write(uid, [&](client *p)
+    {
+        p->files.insert(cid);
+        addr = seederaddr{p, p->hostip, p->hostport};
+    });
+    store.files.write(cid, [&](FileMeta &fm)
+    {
+        fm.peers.insert(uid);
+        fm.online[uid] = addr;
+    });
+}
+
+// running nthreads for secs seconds, returns total ops
+long long run(int nthreads, double secs, int writepct)
+{
+    atomic<bool> stop(false);
+    atomic<long long> total(0);
+    vector<thread> threads;
+    for (int t = 0; t < nthreads; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            mt19937 rng(1234 + t);
+            long long ops = 0;
+            size_t sink = 0;
+            while (!stop.load(memory_order_relaxed))
+            {
+                int g = rng() % NUM_GROUPS, f = rng() % FILES_PER_GROUP, u = rng() % USERS_PER_GROUP;
+                int kind = rng() % 100;
+                if (kind < writepct) filedownloaded(contentid(g, f), userid(g, u));
+                else if (kind % 2) sink += listfiles(groupid(g), userid(g, u));
+                else sink += downloadfile(groupid(g), fileid(g, f), userid(g, u));
+                ops++;
+            }
+            total += ops + (sink == 1); // keeping sink alive
+        });
+    }
+    this_thread::sleep_for(chrono::duration<double>(secs));
+    stop = true;
+    for (auto &t : threads) t.join();
+    return total;
+}
+
+int main(int argc, char *argv[])
+{
+    int maxthreads = argc > 1 ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+    double secs = argc > 2 ? atof(argv[2]) : 2.0;
+    int writepct = argc > 3 ? atoi(argv[3]) : 1;
+    if (maxthreads < 1) maxthreads = 1;
+
+    populate();
+    printf("groups %d, files %d, pieces/file %d, writes %d%%, %u cores\n",
+           NUM_GROUPS, NUM_GROUPS * FILES_PER_GROUP, PIECES_PER_FILE, writepct, thread::hardware_concurrency());
+    printf("%8s %14s %10s\n", "threads", "ops/sec", "speedup");
+
+    // powers of two, always ending at maxthreads
+    vector<int> counts;
+    for (int n = 1; n < maxthreads; n *= 2) counts.push_back(n);
+    counts.push_back(maxthreads);
+
+    double base = 0;
+    for (int n : counts)
+    {
+        double rate = run(n, secs, writepct) / secs;
+        if (n == 1) base = rate;
+        printf("%8d %14.0f %9.2fx\n", n, rate, rate / base);
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+// load generator for a running tracker
+// opens N connections, each with its own logged-in user, and drives a
+// weighted mix of tracker commands over them closed loop (one command in
+// flight per connection). prints throughput and latency percentiles per
+// command, and the tracker's resident memory before and after (from stats)
+//
+// g++ -O2 -o tracker_load tracker_load.cpp -lpthread
+// ./tracker_load <ip:port> [connections] [seconds] [pieces_per_file] [mix]
+// mix: e.g. login=5,list_files=40,download_file=30,file_info=20,upload_file=5
+
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include "../common/frame.h"
+#include "../common/digest.h"
+#include "../tracker/stats.h" // latency buckets
+
+using namespace std;
+
+const int USERS_PER_GROUP = 8;      // connections sharing a group
+const int FILES_PER_GROUP = 16;     // synthetic files uploaded per group at setup
+const size_t HASHES_PER_CHUNK = 4096; // piece hashes per add_piece_hashes, like the client
+
+// commands the mix can contain
+const vector<string> loadcomds = {"login", "list_files", "download_file", "file_info", "upload_file"};
+
+string trackerip;
+int trackerport = 0;
+int piecesperfile = 256;
+string runtag; // keeps names unique across runs against the same tracker
+
+string username(int i) { return "load" + runtag + "_u" + to_string(i); }
+string groupname(int g) { return "load" + runtag + "_g" + to_string(g); }
+string filename(int g, int f) { return "load" + runtag + "_g" + to_string(g) + "_f" + to_string(f); }
+
+// one user's connection to the tracker
+struct loadconn
+{
+    framedsocket sock;
+    int id = 0;
+    string user, gid;
+    mt19937 rng;
+};
+
+bool connecttracker(framedsocket &sock)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(trackerport);
+    if (inet_pton(AF_INET, trackerip.c_str(), &addr.sin_addr) <= 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    sock.setsock(fd);
+    return true;
+}
+
+// sending queued frames and waiting for n replies, false on a dropped connection
+// failed is set when a reply is a tracker error ("-----..." messages)
+bool roundtrip(framedsocket &sock, int n, bool &failed, string *last = nullptr)
+{
+    if (!sock.flush()) return false;
+    failed = false;
+    uint8_t type;
+    string payload;
+    for (int i = 0; i < n; i++)
+    {
+        if (!sock.recvframe(type, payload)) return false;
+        if (!payload.empty() && payload[0] == '-') failed = true;
+    }
+    if (last) *last = payload;
+    return true;
+}
+
+bool command(framedsocket &sock, const string &comd, string *replymsg = nullptr)
+{
+    bool failed;
+    sock.queue(FRAME_COMMAND, comd);
+    return roundtrip(sock, 1, failed, replymsg) && !failed;
+}
+
+// queueing upload_file and its add_piece_hashes chunks, returns frames queued
+int queueupload(loadconn &lc, const string &fname)
+{
+    string hash; // distinct content, the tracker dedups uploads by hash
+    for (int i = 0; i < 40; i++) hash += "0123456789abcdef"[lc.rng() % 16];
+    lc.sock.queue(FRAME_COMMAND, "upload_file " + lc.gid + " " + fname + " " + lc.user + " " +
+                  to_string(piecesperfile * PIECE_SIZE) + " " + hash + " " + to_string(piecesperfile));
+    int frames = 1;
+    for (int start = 0; start < piecesperfile; start += HASHES_PER_CHUNK)
+    {
+        int count = min((int)HASHES_PER_CHUNK, piecesperfile - start);
+        string chunk = "add_piece_hashes " + lc.gid + " " + fname + " " + lc.user + " " + to_string(start) + "\n";
+        for (int i = 0; i < count * (int)DIGEST_SIZE; i++) chunk.push_back((char)lc.rng());
+        lc.sock.queue(FRAME_COMMAND, chunk);
+        frames++;
+    }
+    return frames;
+}
+
+// users, groups and synthetic files, done once before the clock starts
+bool setup(vector<loadconn> &conns)
+{
+    for (auto &lc : conns)
+    {
+        if (!connecttracker(lc.sock)) return false;
+        lc.user = username(lc.id);
+        lc.gid = groupname(lc.id / USERS_PER_GROUP);
+        lc.rng.seed(hash<string>()(runtag) + lc.id); // contents differ between runs too
+        if (!command(lc.sock, "create_user " + lc.user + " pass")) return false;
+        if (!command(lc.sock, "login " + lc.user + " pass 127.0.0.1 " + to_string(20000 + lc.id))) return false;
+
+        loadconn &owner = conns[lc.id / USERS_PER_GROUP * USERS_PER_GROUP];
+        if (&owner == &lc)
+        {
+            if (!command(lc.sock, "create_group " + lc.gid + " " + lc.user)) return false;
+            for (int f = 0; f < FILES_PER_GROUP; f++)
+            {
+                bool failed;
+                int frames = queueupload(lc, filename(lc.id / USERS_PER_GROUP, f));
+                if (!roundtrip(lc.sock, frames, failed) || failed) return false;
+            }
+        }
+        else
+        {
+            if (!command(lc.sock, "join_group " + lc.gid + " " + lc.user)) return false;
+            if (!command(owner.sock, "accept_request " + lc.gid + " " + lc.user + " " + owner.user)) return false;
+        }
+    }
+    return true;
+}
+
+// tracker rss in kB from its stats report, -1 if it did not say
+long long trackerrss()
+{
+    framedsocket sock;
+    if (!connecttracker(sock)) return -1;
+    string msg;
+    command(sock, "stats", &msg);
+    close(sock.fd());
+    size_t pos = msg.find("\nrss_kb ");
+    return pos == string::npos ? -1 : atoll(msg.c_str() + pos + 8);
+}
+
+// per connection results, merged after the run
+struct loadresult
+{
+    vector<uint64_t> ops, errors;
+    vector<vector<uint64_t>> hist;
+    bool dropped = false;
+
+    loadresult() : ops(loadcomds.size()), errors(loadcomds.size()), hist(loadcomds.size(), vector<uint64_t>(LATENCY_BUCKETS)) {}
+};
+
+void drive(loadconn &lc, const vector<int> &weights, atomic<bool> &stop, loadresult &res)
+{
+    int total = 0;
+    for (int w : weights) total += w;
+    int uploads = 0, g = lc.id / USERS_PER_GROUP;
+    while (!stop.load(memory_order_relaxed))
+    {
+        // picking a command by weight
+        int pick = lc.rng() % total, c = 0;
+        while (pick >= weights[c]) pick -= weights[c++];
+
+        string fname = filename(g, lc.rng() % FILES_PER_GROUP);
+        int frames = 1;
+        if (loadcomds[c] == "login") lc.sock.queue(FRAME_COMMAND, "login " + lc.user + " pass 127.0.0.1 " + to_string(20000 + lc.id));
+        else if (loadcomds[c] == "list_files") lc.sock.queue(FRAME_COMMAND, "list_files " + lc.gid + " " + lc.user);
+        else if (loadcomds[c] == "download_file") lc.sock.queue(FRAME_COMMAND, "download_file " + lc.gid + " " + fname + " " + lc.user);
+        else if (loadcomds[c] == "file_info") lc.sock.queue(FRAME_COMMAND, "file_info " + lc.gid + " " + fname + " " + lc.user);
+        else frames = queueupload(lc, "load" + runtag + "_u" + to_string(lc.id) + "_up" + to_string(uploads++));
+
+        bool failed;
+        auto start = chrono::steady_clock::now();
+        if (!roundtrip(lc.sock, frames, failed))
+        {
+            res.dropped = true;
+            return;
+        }
+        auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        res.ops[c]++;
+        if (failed) res.errors[c]++;
+        res.hist[c][latencybucket(us < 0 ? 0 : us)]++;
+    }
+}
+
+// latency in us at quantile q of a histogram
+uint64_t percentile(const vector<uint64_t> &hist, uint64_t count, double q)
+{
+    uint64_t rank = (uint64_t)(q * count), below = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
+    {
+        below += hist[b];
+        if (below > rank) return bucketlimit(b);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || strchr(argv[1], ':') == nullptr)
+    {
+        printf("usage: %s <ip:port> [connections] [seconds] [pieces_per_file] [mix]\n", argv[0]);
+        return 1;
+    }
+    string hostport = argv[1];
+    trackerip = hostport.substr(0, hostport.find(':'));
+    trackerport = atoi(hostport.substr(hostport.find(':') + 1).c_str());
+    int nconns = argc > 2 ? atoi(argv[2]) : 16;
+    double secs = argc > 3 ? atof(argv[3]) : 10.0;
+    piecesperfile = argc > 4 ? atoi(argv[4]) : 256;
+    string mix = argc > 5 ? argv[5] : "login=5,list_files=40,download_file=30,file_info=20,upload_file=5";
+    if (nconns < 1) nconns = 1;
+    if (piecesperfile < 1) piecesperfile = 1;
+
+    // mix "name=weight,..."
+    vector<int> weights(loadcomds.size(), 0);
+    int total = 0;
+    for (size_t pos = 0; pos < mix.size();)
+    {
+        size_t end = mix.find(',', pos);
+        if (end == string::npos) end = mix.size();
+        string item = mix.substr(pos, end - pos);
+        size_t eq = item.find('=');
+        auto it = find(loadcomds.begin(), loadcomds.end(), item.substr(0, eq));
+        if (eq == string::npos || it == loadcomds.end())
+        {
+            printf("bad mix entry '%s', commands: login list_files download_file file_info upload_file\n", item.c_str());
+            return 1;
+        }
+        weights[it - loadcomds.begin()] = max(0, atoi(item.c_str() + eq + 1));
+        total += weights[it - loadcomds.begin()];
+        pos = end + 1;
+    }
+    if (total == 0)
+    {
+        printf("mix has no weight\n");
+        return 1;
+    }
+
+    runtag = to_string(getpid()) + "_" + to_string(time(nullptr) % 100000);
+    vector<loadconn> conns(nconns);
+    for (int i = 0; i < nconns; i++) conns[i].id = i;
+
+    long long rssbefore = trackerrss();
+    printf("tracker %s, connections %d, seconds %.1f, pieces/file %d, mix %s\n", hostport.c_str(), nconns, secs, piecesperfile, mix.c_str());
+    if (!setup(conns))
+    {
+        printf("setup failed, is the tracker running and primary?\n");
+        return 1;
+    }
+    long long rsssetup = trackerrss();
+
+    atomic<bool> stop(false);
+    vector<loadresult> results(nconns);
+    vector<thread> threads;
+    auto started = chrono::steady_clock::now();
+    for (int i = 0; i < nconns; i++) threads.emplace_back(drive, ref(conns[i]), cref(weights), ref(stop), ref(results[i]));
+    this_thread::sleep_for(chrono::duration<double>(secs));
+    stop = true;
+    for (auto &t : threads) t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    long long rssafter = trackerrss();
+    for (auto &lc : conns) close(lc.sock.fd());
+
+    printf("%-14s %10s %12s %8s %10s %10s %10s\n", "command", "ops", "ops/sec", "errors", "p50_us", "p99_us", "p999_us");
+    loadresult sum;
+    vector<uint64_t> all(LATENCY_BUCKETS);
+    uint64_t allops = 0, allerrors = 0;
+    int dropped = 0;
+    for (auto &r : results)
+    {
+        dropped += r.dropped;
+        for (size_t c = 0; c < loadcomds.size(); c++)
+        {
+            sum.ops[c] += r.ops[c];
+            sum.errors[c] += r.errors[c];
+            for (int b = 0; b < LATENCY_BUCKETS; b++) sum.hist[c][b] += r.hist[c][b];
+        }
+    }
+    for (size_t c = 0; c < loadcomds.size(); c++)
+    {
+        if (sum.ops[c] == 0) continue;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) all[b] += sum.hist[c][b];
+        allops += sum.ops[c];
+        allerrors += sum.errors[c];
+        printf("%-14s %10llu %12.0f %8llu %10llu %10llu %10llu\n", loadcomds[c].c_str(), (unsigned long long)sum.ops[c],
+               sum.ops[c] / elapsed, (unsigned long long)sum.errors[c], (unsigned long long)percentile(sum.hist[c], sum.ops[c], 0.5),
+               (unsigned long long)percentile(sum.hist[c], sum.ops[c], 0.99), (unsigned long long)percentile(sum.hist[c], sum.ops[c], 0.999));
+    }
+    printf("%-14s %10llu %12.0f %8llu %10llu %10llu %10llu\n", "total", (unsigned long long)allops, allops / elapsed,
+           (unsigned long long)allerrors, (unsigned long long)percentile(all, allops, 0.5),
+           (unsigned long long)percentile(all, allops, 0.99), (unsigned long long)percentile(all, allops, 0.999));
+    printf("tracker rss_kb before %lld, after setup %lld, after run %lld\n", rssbefore, rsssetup, rssafter);
+    if (dropped) printf("%d connections dropped during the run\n", dropped);
+    return 0;
+}
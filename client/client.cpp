@@ -18,20 +18,54 @@
 #include <sstream>
 #include <functional>
 #include <algorithm>
+#include <memory>
 #include <openssl/evp.h>
 #include <atomic>
+#include <chrono>
+#include "../common/frame.h" // tracker protocol framing
+#include "../common/digest.h" // binary piece hashes
+#include "../common/shardmap.h" // groups to tracker shards
+#include "rpc.h" // async requests over the tracker connection
 
 using namespace std;
 
-static const size_t PIECE_SIZE = 512 * 1024; // 512KB piece size
+static const long long HASH_RANGE = 4096; // piece hashes per tracker request
 
 // globals
 string peername; // name of peer
 bool connected; // is connected
-int serversock; // server socket
+
+// one tracker shard from tracker_info.txt, its replicated trackers and our
+// connections to them. without a shard column there is just one
+struct trackershard 
+{
+    int no = 1; // shard number
+    vector<pair<string, string>> trackers; // ip and port of every tracker of the shard
+    trackerrpc tracker; // requests to the shard's primary, many outstanding at once
+    mutex trackermtx; // one thread reconnecting at a time
+    atomic<unsigned> trackergen{0}; // bumped on every reconnect
+    atomic<int> primaryidx{0}; // tracker taking mutations
+    trackerrpc readtracker; // to a standby tracker, for read-only commands
+    mutex readmtx; // one thread reconnecting readtracker at a time
+    atomic<int> readidx{-1}; // tracker serving our reads, -1 for the primary
+    vector<string> subscriptions; // subscribe commands sent again after reconnecting, guarded by trackermtx
+};
+vector<unique_ptr<trackershard>> shards; // by shard number
+shardring ring; // group ids to shard numbers
+mutex loginmtx; // guards relogin
+string relogin; // login command sent again after reconnecting
+mutex watchmtx; // guards seederwatch, held while a handler runs
+unordered_map<string, unordered_map<string, function<void(const vector<string> &)>>> seederwatch; // content hash to seeder event handlers of running downloads, by file name
+static const int RECONNECT_TRIES = 20; // 500ms apart, covers a tracker restart
+static const int RATE_RETRIES = 10; // sends of a command the tracker's rate limit turns away
+static const int SYNC_TRIES = 20; // logins 200ms apart on a shard the user's copy has not reached
+static const int HEARTBEAT_SECONDS = 5; // renewing our seeder lease, tracker lease is 15 s
+static const int ANNOUNCE_SECONDS = 2; // announcing newly downloaded pieces at most this often
+static const size_t ANNOUNCE_BATCH = 4096; // piece indexes per have_pieces command
 bool noaccept = false; // flag for accept
 int listenSock; // listen socket
-unordered_map<string,string> uploaded_files; // fname to fullpath
+unordered_map<string,string> uploaded_files; // fname to fullpath, guarded by downloads_mtx
+unordered_map<string,string> shared_contents; // full file hash to fullpath, peers of other groups ask by hash, guarded by downloads_mtx
 
 // Download tracking
 struct DownloadInfo 
@@ -43,7 +77,7 @@ struct DownloadInfo
     long long total_pieces; // total pieces
     long long completed_pieces; // completed pieces
     vector<int> piece_status; // 0=pending, 1=downloading, 2=completed, 3=failed
-    vector<string> piece_hashes; // piece hashes
+    vector<sha1digest> piece_hashes; // piece hashes, 20 bytes each
     string full_hash; // full file hash
     bool is_active; // is download active
 };
@@ -52,7 +86,7 @@ unordered_map<string, DownloadInfo> active_downloads; // filename to download in
 mutex downloads_mtx; // mutex for downloads
 
 string filehash(const string &filepath); // function for file hash
-vector<string> compute_piece_hashes(const string &filepath, long long &num_pieces); // function for piece hashes
+vector<sha1digest> compute_piece_hashes(const string &filepath, long long &num_pieces); // function for piece hashes
 
 void displaycomds() 
 {
@@ -66,7 +100,10 @@ void displaycomds()
     cout << "list_requests <groupid>\n";
     cout << "accept_request <groupid> <username>\n";
     cout << "list_groups\n";
-    cout << "list_files <groupid>\n";
+    cout << "list_files <groupid> [prefix=..] [minsize=..] [maxsize=..] [minseeders=..] [limit=..]\n";
+    cout << "search_files <text> [minseeders=..] [limit=..]\n";
+    cout << "subscribe_group <groupid>\n";
+    cout << "unsubscribe_group <groupid>\n";
     cout << "upload_file <groupid> <filepath>\n";
     cout << "download_file <groupid> <filename> <dest_path>\n";
     cout << "stop_share <groupid> <filename>\n";
@@ -104,6 +141,7 @@ queue<int> quetask; // queue for tasks
 mutex mtx; // mutex for queue
 condition_variable cv; // condition variable
 bool poolstop = false; // stop flag
+atomic<int> active_uploads(0); // pieces being served right now, reported with heartbeat
 
 // serve peer requests
 void handling_peer_req(int peersock) 
@@ -143,7 +181,7 @@ void handling_peer_req(int peersock)
             return; 
         }
 
-        string fname = comds[1]; // file name
+        string fname = comds[1]; // full file hash, or file name from older peers
         int index = stoi(comds[2]); // piece index
 
         if (index < 0) 
@@ -151,12 +189,32 @@ void handling_peer_req(int peersock)
             close(peersock); 
             return; 
         }
-        if (uploaded_files.find(fname) == uploaded_files.end()) 
+        string fullpath; // get path
+        {
+            lock_guard<mutex> lock(downloads_mtx); // downloads finishing add to the maps meanwhile
+            auto sc = shared_contents.find(fname); 
+            auto uf = uploaded_files.find(fname); 
+            if (sc != shared_contents.end()) fullpath = sc->second; 
+            else if (uf != uploaded_files.end()) fullpath = uf->second; 
+            else 
+            {
+                // unfinished download, serving the pieces we already have
+                for (auto &it : active_downloads) 
+                {
+                    if (it.first != fname && it.second.full_hash != fname) continue;
+                    if (index < (int)it.second.piece_status.size() && it.second.piece_status[index] == 2) 
+                    {
+                        fullpath = it.second.dest_path; 
+                    }
+                    break;
+                }
+            }
+        }
+        if (fullpath.empty()) 
         { 
             close(peersock); 
             return; 
         }
-        string fullpath = uploaded_files[fname]; // get path
 
         int fd = open(fullpath.c_str(), O_RDONLY); // open file
         if (fd < 0) 
@@ -165,6 +223,7 @@ void handling_peer_req(int peersock)
             return; 
         }
 
+        active_uploads++; // tracker ranks busy seeders lower
         off_t offset = (off_t)index * PIECE_SIZE; // offset for piece
         vector<char> buf(PIECE_SIZE);
         ssize_t n = pread(fd, buf.data(), PIECE_SIZE, offset);
@@ -191,6 +250,7 @@ void handling_peer_req(int peersock)
                 total_sent += sent; // adding sent
             }
         }
+        active_uploads--; 
     }
     close(peersock);
 }
@@ -267,23 +327,371 @@ void handling_peer_conn(string ip, string port)
     close(sock);
 }
 
-string sendcomd(int sock, const string &cmd) 
+// shard holding tracker number no
+trackershard &shardno(int no) 
+{
+    for (auto &s : shards) 
+    {
+        if (s->no == no) return *s; 
+    }
+    return *shards[0]; 
+}
+
+// shard owning group gid, where every command about the group goes
+trackershard &shardfor(const string &gid) 
 {
-    ssize_t sent = send(sock, cmd.c_str(), cmd.size(), 0);
-    if (sent < 0) 
+    return shardno(ring.owner(gid)); 
+}
+
+// shard whose word on user counts: it decides whether the name is taken and
+// whether a passcode is right, the others hold copies of the registration
+trackershard &homeshard(const string &user) 
+{
+    return shardno(ring.owner(user)); 
+}
+
+// connecting to tracker idx of shard s, -1 if unreachable
+int dialtracker(trackershard &s, int idx) 
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0); 
+    if (sock < 0) 
     { 
-        perror("send failed"); 
-        return ""; 
-    } 
-    char buff[2097152];
-    memset(buff, 0, sizeof(buff));
-    ssize_t recvd = read(sock, buff, sizeof(buff) - 1);
-    if (recvd < 0) 
+        cout << "-------- Unable to create socket -------" << endl; 
+        return -1; 
+    }
+
+    struct sockaddr_in server_addr; 
+    server_addr.sin_family = AF_INET; 
+    server_addr.sin_port = htons(atoi(s.trackers[idx].second.c_str())); 
+    if (inet_pton(AF_INET, s.trackers[idx].first.c_str(), &server_addr.sin_addr) <= 0) 
     { 
-        perror("read failed"); 
-        return ""; 
+        cout << "------- Error: Unable to parse address -------" << endl; 
+        close(sock); 
+        return -1; 
+    }
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) 
+    { 
+        close(sock); 
+        return -1; 
+    }
+    return sock; 
+}
+
+// asking a freshly connected tracker for its role, before rpc takes the socket
+string askrole(int sock) 
+{
+    framedsocket probe; 
+    probe.setsock(sock); 
+    uint8_t type = 0; 
+    string role; 
+    if (!probe.sendframe(FRAME_COMMAND, "tracker_role")) return ""; 
+    while (probe.recvframe(type, role)) 
+    {
+        if (type == FRAME_REPLY) return role; 
+    }
+    return ""; 
+}
+
+// connecting (again) to the primary tracker of shard s, caller holds s.trackermtx
+// starts at the last known primary, a standby that names the primary sends us there
+bool connecttracker(trackershard &s) 
+{
+    int n = s.trackers.size(); 
+    int idx = s.primaryidx; 
+    for (int tries = 0; tries <= n; ++tries) // every tracker once, plus one redirect
+    {
+        int next = (idx + 1) % n; 
+        int sock = dialtracker(s, idx); 
+        if (sock >= 0) 
+        {
+            string role = askrole(sock); 
+            int standbyno, primaryno; 
+            if (!role.empty() && role.compare(0, 13, "ROLE STANDBY ") != 0) // primary (or tracker without replication)
+            {
+                s.tracker.start(sock); 
+                s.primaryidx = idx; 
+                s.trackergen++; 
+                return true; 
+            }
+            if (sscanf(role.c_str(), "ROLE STANDBY %d %d", &standbyno, &primaryno) == 2 && 
+                primaryno >= 1 && primaryno <= n && primaryno - 1 != idx) 
+            {
+                next = primaryno - 1; 
+            }
+            close(sock); 
+        }
+        idx = next; 
+    }
+    return false; 
+}
+
+// copying reply texts, false if any request failed or hit a standby
+bool takereplies(const vector<rpcreply> &r, vector<string> &replies) 
+{
+    bool ok = true; 
+    for (size_t i = 0; i < r.size(); ++i) 
+    {
+        replies[i] = r[i].msg; 
+        if (!r[i].ok || r[i].msg.compare(0, 11, "NOT_PRIMARY") == 0) ok = false; // standbys refuse mutations
+    }
+    return ok; 
+}
+
+// sending commands to the primary of shard s in one write and collecting replies in order
+// any number of threads can have batches outstanding on the connection at once.
+// if the tracker went away (restart, or another tracker took over) the first
+// caller to notice reconnects to the primary and logs back in, the rest retry
+vector<string> sendprimary(trackershard &s, const vector<string> &cmds) 
+{
+    vector<string> replies(cmds.size()); 
+    for (int i = 0; i <= RECONNECT_TRIES; ++i) 
+    {
+        unsigned gen = s.trackergen; // connection the batch went out on
+        if (takereplies(s.tracker.callall(cmds), replies)) return replies; 
+        if (i == RECONNECT_TRIES) break; 
+
+        lock_guard<mutex> lock(s.trackermtx); 
+        if (s.trackergen != gen) continue; // someone else reconnected meanwhile
+        if (i == 0) cout << "------- Connection to primary tracker lost, reconnecting -------" << endl; 
+        s.tracker.stop(); 
+        this_thread::sleep_for(chrono::milliseconds(500)); 
+        if (!connecttracker(s)) continue; 
+        string login; // session to restore
+        {
+            lock_guard<mutex> llock(loginmtx); 
+            login = relogin; 
+        }
+        vector<string> loginreply(1); 
+        if (!login.empty() && !takereplies(s.tracker.callall({login}), loginreply)) 
+        {
+            s.tracker.stop(); 
+            continue; 
+        }
+        if (!s.subscriptions.empty()) s.tracker.callall(s.subscriptions); // the old connection's went with it
+        cout << "------- Reconnected to tracker " << s.primaryidx + 1 << (shards.size() > 1 ? " of shard " + to_string(s.no) : "") << " -------" << endl; 
+    }
+    cout << "------- Tracker unreachable -------" << endl; 
+    for (auto &r : replies) r.clear(); 
+    return replies; 
+}
+
+// sending a batch, and sending it again from the first command the tracker
+// turned away with "RETRY_AFTER <ms>" (over its rate limit) once that wait is
+// over. the commands after it go again too, they may depend on it
+vector<string> sendlimited(trackershard &s, const vector<string> &cmds, vector<string> (*send)(trackershard &, const vector<string> &)) 
+{
+    vector<string> replies = send(s, cmds); 
+    for (int i = 0; i < RATE_RETRIES; ++i) 
+    {
+        size_t first = 0; // first command turned away
+        while (first < replies.size() && replies[first].compare(0, 12, "RETRY_AFTER ") != 0) first++; 
+        if (first == replies.size()) break; 
+        long long waitms = 0; // longest wait asked
+        for (size_t j = first; j < replies.size(); ++j) 
+        {
+            if (replies[j].compare(0, 12, "RETRY_AFTER ") == 0) waitms = max(waitms, atoll(replies[j].c_str() + 12)); 
+        }
+        this_thread::sleep_for(chrono::milliseconds(waitms)); 
+        vector<string> again = send(s, vector<string>(cmds.begin() + first, cmds.end())); 
+        copy(again.begin(), again.end(), replies.begin() + first); 
+    }
+    return replies; 
+}
+
+vector<string> sendcomds(trackershard &s, const vector<string> &cmds) 
+{
+    return sendlimited(s, cmds, sendprimary); 
+}
+
+string sendcomd(trackershard &s, const string &cmd) 
+{
+    return sendcomds(s, vector<string>{cmd})[0]; 
+}
+
+// read-only commands, served by the shard's standby tracker picked for us when
+// there is one so reads spread over every tracker. standbys apply the log a
+// little behind the primary, and if ours goes away reads stay on the primary
+// from then on
+vector<string> sendreadonce(trackershard &s, const vector<string> &cmds) 
+{
+    if (s.readidx >= 0 && s.readidx != s.primaryidx) 
+    {
+        {
+            lock_guard<mutex> lock(s.readmtx); 
+            if (!s.readtracker.connected() && s.readidx >= 0) 
+            {
+                int sock = dialtracker(s, s.readidx); 
+                if (sock >= 0) s.readtracker.start(sock); 
+            }
+        }
+        vector<string> replies(cmds.size()); 
+        if (takereplies(s.readtracker.callall(cmds), replies)) return replies; 
+
+        lock_guard<mutex> lock(s.readmtx); 
+        s.readtracker.stop(); 
+        s.readidx = -1; 
+    }
+    return sendprimary(s, cmds); 
+}
+
+vector<string> sendreadcomds(trackershard &s, const vector<string> &cmds) 
+{
+    return sendlimited(s, cmds, sendreadonce); 
+}
+
+string sendreadcomd(trackershard &s, const string &cmd) 
+{
+    return sendreadcomds(s, vector<string>{cmd})[0]; 
+}
+
+// a reply without its "#..." title line, for the shards after the first when
+// the replies of every shard are printed as one
+string untitled(const string &r) 
+{
+    if (r.empty() || r[0] != '#') return r; 
+    size_t nl = r.find('\n'); 
+    return nl == string::npos ? "" : r.substr(nl + 1); 
+}
+
+// printing every page of a paged listing (list_files, search_files) from shard s,
+// one page in memory at a time. a page with more after it ends with "NEXT <name>",
+// or "NEXT <name> <gid>" for a search page cut among the groups of one name
+// titled false leaves out the title line, another shard printed it already
+void printpages(trackershard &s, const string &cmd, bool titled = true) 
+{
+    string after; // cursor from the last page, as options
+    while (true) 
+    {
+        string page = sendreadcomd(s, cmd + after); 
+        if (!titled && after.empty()) page = untitled(page); 
+        size_t next = page.rfind("NEXT "); 
+        size_t space = next == string::npos ? next : page.find(' ', next + 5); // before the group
+        if (next == string::npos || (next > 0 && page[next - 1] != '\n') || 
+            (space != string::npos && page.find(' ', space + 1) != string::npos)) 
+        {
+            if (!page.empty()) cout << page << endl; 
+            break; 
+        }
+        cout << page.substr(0, next) << flush; 
+        string cursor = page.substr(next + 5); 
+        if (!cursor.empty() && cursor.back() == '\n') cursor.pop_back(); 
+        space = cursor.find(' '); 
+        after = " after=" + (space == string::npos ? cursor : cursor.substr(0, space) + " aftergroup=" + cursor.substr(space + 1)); 
+    }
+}
+
+// subscribing this connection to tracker events, kept across reconnects
+// the subscription goes to s, the shard of the group named in cmd
+string subscribe(trackershard &s, const string &cmd) 
+{
+    string r = sendcomd(s, cmd); 
+    if (r.compare(0, 11, "SUBSCRIBED ") != 0) return r; 
+    lock_guard<mutex> lock(s.trackermtx); 
+    if (find(s.subscriptions.begin(), s.subscriptions.end(), cmd) == s.subscriptions.end()) s.subscriptions.push_back(cmd); 
+    return r; 
+}
+
+// undoing subscribe, cmd is the subscribe command
+string unsubscribe(trackershard &s, const string &cmd) 
+{
+    {
+        lock_guard<mutex> lock(s.trackermtx); 
+        s.subscriptions.erase(remove(s.subscriptions.begin(), s.subscriptions.end(), cmd), s.subscriptions.end()); 
+    }
+    return sendcomd(s, "un" + cmd); 
+}
+
+// users are not sharded: create_user goes to the user's home shard, the only
+// one that takes it, and that shard's tracker copies the user to every other
+// shard on its own
+string createuser(const string &user, const string &pass) 
+{
+    return sendcomd(homeshard(user), "create_user " + user + " " + pass); 
+}
+
+// logging in on the home shard, then on every other one. a shard the home
+// shard's copy has not reached yet is waited for, and one that never got
+// it (its primary went away before sending) gets it again through
+// sync_user. returns the home's reply
+string loginall(const string &user, const string &msg) 
+{
+    trackershard &home = homeshard(user); 
+    string r = sendcomd(home, msg); 
+    if (r.empty() || r[0] != 'S') return r; 
+    bool synced = false; // asked the home shard to copy again
+    for (auto &s : shards) 
+    {
+        if (s.get() == &home) continue; 
+        string sr = sendcomd(*s, msg); 
+        for (int i = 0; i < SYNC_TRIES && sr.find("is not registered") != string::npos; i++) 
+        {
+            if (i == SYNC_TRIES / 2 && !synced) 
+            {
+                sendcomd(home, "sync_user " + user); 
+                synced = true; 
+            }
+            this_thread::sleep_for(chrono::milliseconds(200)); 
+            sr = sendcomd(*s, msg); 
+        }
+        if (sr.empty() || sr[0] != 'S') cout << "------- Shard " << s->no << ": " << sr << " -------" << endl; 
+    }
+    return r; 
+}
+
+// event pushed by the tracker, on the connection's reader thread so it must not
+// wait on the tracker itself. seeder events go to the downloads of that content
+void trackerevent(const string &ev) 
+{
+    vector<string> words; 
+    string word; 
+    stringstream ss(ev); 
+    while (ss >> word) words.push_back(word); 
+    if (words.empty()) return; 
+    if (words[0] == "FILE_UPLOADED" && words.size() == 5) 
+    {
+        cout << "[group " << words[1] << "] " << words[4] << " uploaded " << words[2] << " (" << words[3] << " bytes)" << endl; 
     } 
-    return string(buff, recvd); 
+    else if ((words[0] == "SEEDER_JOINED" || words[0] == "SEEDER_LEFT") && words.size() >= 3) 
+    {
+        lock_guard<mutex> lock(watchmtx); 
+        auto it = seederwatch.find(words[1]); 
+        if (it == seederwatch.end()) return; 
+        for (auto &w : it->second) w.second(words); 
+    } 
+    else if (words[0] == "EVENTS_MISSED") 
+    {
+        cout << "------- Missed " << (words.size() > 1 ? words[1] : "some") << " tracker events -------" << endl; 
+    }
+}
+
+// keeping our seeder lease alive on every shard while logged in, logging in
+// again on a shard where it lapsed
+void heartbeatloop() 
+{
+    while (true) 
+    {
+        this_thread::sleep_for(chrono::seconds(HEARTBEAT_SECONDS)); 
+        string login; // login command of current session
+        {
+            lock_guard<mutex> lock(loginmtx); 
+            login = relogin; 
+        }
+        if (login.empty()) continue; // not logged in
+
+        stringstream ls(login); 
+        string verb, user; 
+        ls >> verb >> user; 
+        for (auto &s : shards) 
+        {
+            if (sendcomd(*s, "heartbeat " + user + " " + to_string(active_uploads.load())).compare(0, 13, "NOT_LOGGED_IN") != 0) continue; 
+            {
+                lock_guard<mutex> lock(loginmtx); 
+                if (relogin != login) break; // logged out meanwhile
+            }
+            cout << "------- Seeder lease lapsed, logging in again -------" << endl; 
+            sendcomd(*s, login); 
+        }
+    }
 }
 
 string filehash(const string &filepath) 
@@ -306,19 +714,20 @@ string filehash(const string &filepath)
     EVP_DigestFinal_ex(ctx, hash, &len); // finishes hashing
     EVP_MD_CTX_free(ctx); // freeingg
     
-    char hex[41];
-    for (unsigned int i = 0; i < len; ++i) 
-    {
-        sprintf(hex + i*2, "%02x", hash[i]); // to hex
-    }
-    
-    hex[40] = 0;
-    return string(hex);
+    return digesttohex(hash, len); // to hex
 }
 
-vector<string> compute_piece_hashes(const string &filepath, long long &num_pieces) 
+// SHA1 of one piece as raw digest
+sha1digest piecedigest(const char *data, size_t n) 
 {
-    vector<string> hashes; // hashes vector
+    sha1digest d; 
+    EVP_Digest(data, n, d.b, NULL, EVP_sha1(), NULL); // one shot hash
+    return d; 
+}
+
+vector<sha1digest> compute_piece_hashes(const string &filepath, long long &num_pieces) 
+{
+    vector<sha1digest> hashes; // hashes vector
     int fd = open(filepath.c_str(), O_RDONLY); 
     if (fd < 0) 
     { 
@@ -330,19 +739,13 @@ vector<string> compute_piece_hashes(const string &filepath, long long &num_piece
     lseek(fd, 0, SEEK_SET); // resetting
     num_pieces = (filesize + PIECE_SIZE - 1) / PIECE_SIZE; // calc pieces
     
+    hashes.reserve(num_pieces); 
+    vector<char> buf(PIECE_SIZE); 
     for (long long i = 0; i < num_pieces; ++i) 
     {
-        vector<char> buf(PIECE_SIZE); 
         ssize_t n = read(fd, buf.data(), PIECE_SIZE); // read piece
         if (n <= 0) break; 
-        EVP_MD_CTX *ctx = EVP_MD_CTX_new(); // hash context
-        EVP_DigestInit_ex(ctx, EVP_sha1(), NULL); // init hash
-        EVP_DigestUpdate(ctx, buf.data(), n); // update hash
-        unsigned char hash[EVP_MAX_MD_SIZE]; unsigned int hlen;
-        EVP_DigestFinal_ex(ctx, hash, &hlen); // finish hash
-        EVP_MD_CTX_free(ctx); // free context
-        char hex[41]; for (unsigned int j=0;j<hlen;j++) sprintf(hex+j*2,"%02x",hash[j]); hex[40]=0;
-        hashes.push_back(string(hex)); // add hash
+        hashes.push_back(piecedigest(buf.data(), n)); // add hash
     }
     close(fd);
     return hashes;
@@ -370,48 +773,37 @@ int main(int argc, char *argv[])
         idx++;
     }
 
-    string serverip, serverport;
-    FILE *file = fopen(argv[2], "r");
-    if (!file) 
+    vector<trackeraddr> addrs = readtrackerinfo(argv[2]); // every tracker
+    if (addrs.empty()) 
     { 
-        cout << "Failed to open tracker info file" << endl; 
+        cout << "Failed to read tracker info" << endl; 
         return 0; 
     }
-    char ipbuf[128], portbuf[32];
-    
-    if (fscanf(file, "%127s %31s", ipbuf, portbuf) != 2) 
-    { 
-        cout << "Failed to read tracker info" << endl; fclose(file); 
-        return 0; 
+    ring.build(addrs); 
+    for (int no : ring.shards()) 
+    {
+        shards.push_back(make_unique<trackershard>()); 
+        shards.back()->no = no; 
     }
+    for (auto &a : addrs) shardno(a.shard).trackers.push_back({a.ip, a.port}); 
 
-    fclose(file); 
-    serverip = ipbuf; 
-    serverport = portbuf; 
-
-    // connect to tracker
-    if ((serversock = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
-    { 
-        cout << "-------- Unable to create socket -------" << endl; 
-        return 0; 
+    // connect to the primary of every shard
+    for (auto &s : shards) 
+    {
+        s->tracker.onevent = trackerevent; 
+        if (!connecttracker(*s)) 
+        { 
+            cout << "-------- Failed to establish socket connection --------" << endl; 
+            return 0; 
+        }
+        // reads go to a tracker picked by our address, spreading clients over the standbys
+        if (s->trackers.size() > 1) 
+        {
+            s->readidx = hash<string>()(hostip + ":" + hostport) % s->trackers.size(); 
+        }
     }
 
-    struct sockaddr_in server_addr; 
-    server_addr.sin_family = AF_INET; 
-    int port = stoi(serverport); 
-    server_addr.sin_port = htons(port); 
-    
-    if (inet_pton(AF_INET, serverip.c_str(), &server_addr.sin_addr) <= 0) 
-    { 
-        cout << "------- Error: Unable to parse address -------" << endl; 
-        return 0; 
-    }
-    
-    if (connect(serversock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) 
-    { 
-        cout << "-------- Failed to establish socket connection --------" << endl; 
-        return 0; 
-    }
+    thread(heartbeatloop).detach(); // seeder lease
 
     // thread pool to serve peers
     vector<thread> workers; // workers
@@ -455,9 +847,23 @@ int main(int argc, char *argv[])
                 }
                 string gid = cmds[1], fname = cmds[2];
                 // Remove from local uploaded_files
-                if (uploaded_files.find(fname) != uploaded_files.end()) 
+                bool shared = false; // we were serving it
+                {
+                    lock_guard<mutex> lock(downloads_mtx); 
+                    auto uf = uploaded_files.find(fname); 
+                    if (uf != uploaded_files.end()) 
+                    {
+                        shared = true; 
+                        for (auto it = shared_contents.begin(); it != shared_contents.end(); ) 
+                        {
+                            if (it->second == uf->second) it = shared_contents.erase(it);
+                            else ++it;
+                        }
+                        uploaded_files.erase(uf); // erase
+                    }
+                }
+                if (shared) 
                 {
-                    uploaded_files.erase(fname); // erase
                     cout << "Stopped sharing file: " << fname << " in group " << gid << endl;
                 } 
                 else 
@@ -466,7 +872,7 @@ int main(int argc, char *argv[])
                 }
                 // telling tracker to remove this peer as seeder
                 string msg = "stop_share " + gid + " " + fname + " " + peername; 
-                string resp = sendcomd(serversock, msg); 
+                string resp = sendcomd(shardfor(gid), msg); 
                 cout << resp << endl;
             });
         };
@@ -478,8 +884,7 @@ int main(int argc, char *argv[])
                 cout << "Usage: create_user <user> <pass>\n"; 
                 return; 
             }
-            string msg = "create_user " + cmds[1] + " " + cmds[2];
-            cout << sendcomd(serversock, msg) << endl; 
+            cout << createuser(cmds[1], cmds[2]) << endl; 
         };
 
         cmdMap["login"] = [&]() 
@@ -495,11 +900,15 @@ int main(int argc, char *argv[])
                 return; 
             }
             string msg = "login " + cmds[1] + " " + cmds[2] + " " + hostip + " " + hostport; 
-            string r = sendcomd(serversock, msg); 
+            string r = loginall(cmds[1], msg); 
             if (!r.empty() && r[0] == 'S') 
             { 
                 logout_local(); 
                 login_local(cmds[1]); 
+                {
+                    lock_guard<mutex> lock(loginmtx); 
+                    relogin = msg; // for reconnects
+                }
                 cout << "********* You are now logged in *********" << endl; 
             }
             else cout << r << endl;
@@ -509,8 +918,27 @@ int main(int argc, char *argv[])
         {
             logincheck([&]() 
             {
-                string r = sendcomd(serversock, "logout " + peername);
+                string r; // home shard's reply
+                for (auto &s : shards) 
+                {
+                    string sr = sendcomd(*s, "logout " + peername); 
+                    if (s.get() == &homeshard(peername)) r = sr; 
+                }
                 cout << r << endl; 
+                {
+                    lock_guard<mutex> lock(loginmtx); 
+                    relogin.clear(); 
+                }
+                for (auto &s : shards) 
+                {
+                    vector<string> unsubs; // subscriptions end with the session
+                    {
+                        lock_guard<mutex> lock(s->trackermtx); 
+                        for (auto &c : s->subscriptions) unsubs.push_back("un" + c); 
+                        s->subscriptions.clear(); 
+                    }
+                    if (!unsubs.empty()) sendcomds(*s, unsubs); 
+                }
                 logout_local(); 
             });
         };
@@ -524,7 +952,7 @@ int main(int argc, char *argv[])
                     cout << "Usage: create_group <groupid>\n"; 
                     return; 
                 }
-                cout << sendcomd(serversock, "create_group " + cmds[1] + " " + peername) << endl; 
+                cout << sendcomd(shardfor(cmds[1]), "create_group " + cmds[1] + " " + peername) << endl; 
             });
         };
 
@@ -537,7 +965,7 @@ int main(int argc, char *argv[])
                     cout << "Usage: join_group <groupid>\n"; 
                     return; 
                 }
-                cout << sendcomd(serversock, "join_group " + cmds[1] + " " + peername) << endl; 
+                cout << sendcomd(shardfor(cmds[1]), "join_group " + cmds[1] + " " + peername) << endl; 
             });
         };
 
@@ -550,7 +978,7 @@ int main(int argc, char *argv[])
                     cout << "Usage: leave_group <groupid>\n"; 
                     return; 
                 }
-                cout << sendcomd(serversock, "leave_group " + cmds[1] + " " + peername) << endl; 
+                cout << sendcomd(shardfor(cmds[1]), "leave_group " + cmds[1] + " " + peername) << endl; 
             });
         };
 
@@ -563,7 +991,7 @@ int main(int argc, char *argv[])
                     cout << "Usage: list_requests <groupid>\n"; 
                     return; 
                 }
-                cout << sendcomd(serversock, "list_requests " + cmds[1] + " " + peername) << endl; 
+                cout << sendcomd(shardfor(cmds[1]), "list_requests " + cmds[1] + " " + peername) << endl; 
             });
         };
 
@@ -576,7 +1004,7 @@ int main(int argc, char *argv[])
                     cout << "Usage: accept_request <groupid> <user>\n"; 
                     return; 
                 } 
-                cout << sendcomd(serversock, "accept_request " + cmds[1] + " " + cmds[2] + " " + peername) << endl; 
+                cout << sendcomd(shardfor(cmds[1]), "accept_request " + cmds[1] + " " + cmds[2] + " " + peername) << endl; 
             });
         };
 
@@ -584,7 +1012,13 @@ int main(int argc, char *argv[])
         {
             logincheck([&]() 
             { 
-                cout << sendcomd(serversock, "list_groups") << endl; 
+                string r = sendreadcomd(*shards[0], "list_groups"); // every shard's groups under one title
+                for (size_t i = 1; i < shards.size(); ++i) 
+                {
+                    string more = untitled(sendreadcomd(*shards[i], "list_groups")); 
+                    if (!more.empty()) r += "\n" + more; 
+                }
+                cout << r << endl; 
             }); 
         };
 
@@ -592,16 +1026,59 @@ int main(int argc, char *argv[])
         {
             logincheck([&]() 
             {
-                if (length != 2) 
+                if (length < 2) 
+                { 
+                    cout << "Usage: list_files <groupid> [prefix=..] [minsize=..] [maxsize=..] [minseeders=..] [limit=..]\n"; 
+                    return; 
+                }
+                string cmd = "list_files " + cmds[1] + " " + peername; // filters and page size go through as given
+                for (int i = 2; i < length; i++) cmd += " " + cmds[i]; 
+                printpages(shardfor(cmds[1]), cmd); 
+            });
+        };
+
+        cmdMap["search_files"] = [&]() 
+        {
+            logincheck([&]() 
+            {
+                if (length < 2) 
                 { 
-                    cout << "Usage: list_files <groupid>\n"; 
+                    cout << "Usage: search_files <text> [minseeders=..] [limit=..]\n"; 
                     return; 
                 }
-                cout << sendcomd(serversock, "list_files " + cmds[1] + " " + peername) << endl; 
+                string cmd = "search_files " + peername + " " + cmds[1]; // across every group we are in, on every shard
+                for (int i = 2; i < length; i++) cmd += " " + cmds[i]; 
+                for (auto &s : shards) printpages(*s, cmd, s == shards[0]); 
             });
         };
 
         // upload_file: allow spaces in filepath by recombining tokens
+        cmdMap["subscribe_group"] = [&]() 
+        {
+            logincheck([&]() 
+            {
+                if (length != 2) 
+                { 
+                    cout << "Usage: subscribe_group <groupid>\n"; 
+                    return; 
+                }
+                cout << subscribe(shardfor(cmds[1]), "subscribe " + peername + " group " + cmds[1]) << endl; 
+            });
+        };
+
+        cmdMap["unsubscribe_group"] = [&]() 
+        {
+            logincheck([&]() 
+            {
+                if (length != 2) 
+                { 
+                    cout << "Usage: unsubscribe_group <groupid>\n"; 
+                    return; 
+                }
+                cout << unsubscribe(shardfor(cmds[1]), "subscribe " + peername + " group " + cmds[1]) << endl; 
+            });
+        };
+
         cmdMap["upload_file"] = [&]() 
         {
             logincheck([&]() 
@@ -633,17 +1110,41 @@ int main(int argc, char *argv[])
                 }
                 // compute piece hashes and full hash
                 long long num_pieces = 0; // pieces
-                vector<string> piece_hashes = compute_piece_hashes(fpath, num_pieces); // get hashes
+                vector<sha1digest> piece_hashes = compute_piece_hashes(fpath, num_pieces); // get hashes
                 string fullhash = filehash(fpath); // get full hash
                 size_t pos = fpath.find_last_of("/"); // find last /
                 string fname = (pos == string::npos) ? fpath : fpath.substr(pos + 1); // get file name
                 // store file locally so peer server can serve pieces
-                uploaded_files[fname] = fpath;
+                {
+                    lock_guard<mutex> lock(downloads_mtx); 
+                    uploaded_files[fname] = fpath;
+                    shared_contents[fullhash] = fpath;
+                }
 
-                string cmd = "upload_file " + gid + " " + fname + " " + peername + " " + to_string(fsize) + " " + fullhash + " " + to_string(num_pieces);
-                for (auto &h : piece_hashes) cmd += " " + h; // add hashes
-                string r = sendcomd(serversock, cmd);
-                cout << r << endl;
+                // header first, piece hashes follow in ranges, all sent in one write
+                vector<string> batch; 
+                batch.push_back("upload_file " + gid + " " + fname + " " + peername + " " + to_string(fsize) + " " + fullhash + " " + to_string(num_pieces));
+                for (long long start = 0; start < num_pieces; start += HASH_RANGE) 
+                {
+                    // command line, then raw 20-byte digests
+                    string chunk = "add_piece_hashes " + gid + " " + fname + " " + peername + " " + to_string(start) + "\n"; 
+                    long long count = min(HASH_RANGE, num_pieces - start); 
+                    chunk.append((const char *)piece_hashes[start].b, count * DIGEST_SIZE); // add hashes
+                    batch.push_back(chunk); 
+                }
+                vector<string> r = sendcomds(shardfor(gid), batch);
+                cout << r[0] << endl;
+                if (r[0].find("successfully") != string::npos) 
+                {
+                    for (size_t i = 1; i < r.size(); ++i) 
+                    {
+                        if (r[i].rfind("SUCCESS", 0) != 0) 
+                        { 
+                            cout << r[i] << endl; 
+                            break; 
+                        }
+                    }
+                }
             });
         };
 
@@ -654,460 +1155,709 @@ int main(int argc, char *argv[])
             logincheck([&]() {
                 if (length < 4) 
                 { 
-                    cout << "Usage: download_file <groupid> <filename> <dest_path>\n"; 
+                    cout << "Usage: download_file <groupid> <filename> [filename...] <dest_path>\n"; 
                     return; 
                 }
 
-                string gid = cmds[1], fname = cmds[2], destpath = cmds[3];
-                
-                // checking if already downloading this file
+                string gid = cmds[1], destpath = cmds[length - 1];
+                vector<string> fnames(cmds.begin() + 2, cmds.begin() + length - 1); // files to fetch
+                if (destpath.back() != '/') 
                 {
-                    lock_guard<mutex> lock(downloads_mtx); 
-                    if (active_downloads.find(fname) != active_downloads.end() && active_downloads[fname].is_active) 
-                    {
-                        cout << "File " << fname << " is already being downloaded.\n";
-                        return;
-                    }
+                    destpath += "/";
                 }
 
-                // read all bytes from a socket
-                auto read_all = [](int sock, char *buf, size_t n) -> bool 
-                {
-                    size_t total = 0;
-                    while (total < n) 
-                    {
-                        ssize_t r = read(sock, buf + total, n - total); 
-                        if (r <= 0) return false; 
-                        total += r; 
-                    }
-                    return true; 
-                };
+                // metadata for every file in one pipelined batch, a single round trip
+                vector<string> infocmds; // file_info per file
+                for (auto &f : fnames) infocmds.push_back("file_info " + gid + " " + f + " " + peername); 
+                vector<string> infos = sendreadcomds(shardfor(gid), infocmds); 
 
-                // query tracker for file metadata and peers
-                string tracker_cmd = "download_file " + gid + " " + fname + " " + peername; 
-                
-                string r = sendcomd(serversock, tracker_cmd); 
-                if (r.rfind("FILE ", 0) != 0) 
-                { 
-                    cout << r << endl; 
-                    return; 
-                }
-
-                // parsing file metadata
-                stringstream s(r); 
-                string token; 
-                long long size = 0; 
-                string fullhash;
-                long long num_pieces = 0; 
-                vector<string> piece_hashes; 
-                string word; 
-                while (s >> word) 
+                // standby may not have some of them yet, asking the primary for those in one batch
+                vector<string> retrycmds; // file_info again
+                vector<size_t> retryidx; // which files
+                for (size_t i = 0; i < infos.size(); ++i) 
                 {
-                    if (word == "SIZE") s >> size; 
-                    else if (word == "HASH") s >> fullhash; 
-                    else if (word == "PIECES") s >> num_pieces; 
-                    else if (word == "PIECE_HASHES") break; 
+                    if (infos[i].rfind("FILE ", 0) == 0) continue; 
+                    retrycmds.push_back(infocmds[i]); 
+                    retryidx.push_back(i); 
                 }
-                piece_hashes.resize(num_pieces); // resize
-                for (long long i = 0; i < num_pieces; ++i)
+                if (!retrycmds.empty()) 
                 {
-                    s >> piece_hashes[i]; // get hashes
-                } 
+                    vector<string> again = sendcomds(shardfor(gid), retrycmds); 
+                    for (size_t i = 0; i < again.size(); ++i) infos[retryidx[i]] = again[i]; 
+                }
 
-                // parses available peers
-                size_t pos = r.find("\nPEERS\n"); // find peers
-                vector<tuple<string,string,string>> peerlist; // peer list
-                
-                if (pos != string::npos) 
+                // downloading one file given its file_info reply
+                auto downloadone = [&](string fname, string r) 
                 {
-                    string peers_block = r.substr(pos + 7); // get block
-                    stringstream sp(peers_block); 
-                    string pname, pip, pport; 
-                    while (sp >> pname >> pip >> pport) 
+                
+                    // checking if already downloading this file
                     {
-                        peerlist.emplace_back(pname, pip, pport);
+                        lock_guard<mutex> lock(downloads_mtx); 
+                        if (active_downloads.find(fname) != active_downloads.end() && active_downloads[fname].is_active) 
+                        {
+                            cout << "File " << fname << " is already being downloaded.\n";
+                            return;
+                        }
                     }
-                }
 
-                if (peerlist.empty()) 
-                { 
-                    cout << "No active peers available for " << fname << ".\n"; 
-                    return; 
-                }
+                    // read all bytes from a socket
+                    auto read_all = [](int sock, char *buf, size_t n) -> bool 
+                    {
+                        size_t total = 0;
+                        while (total < n) 
+                        {
+                            ssize_t r = read(sock, buf + total, n - total); 
+                            if (r <= 0) return false; 
+                            total += r; 
+                        }
+                        return true; 
+                    };
 
-                if (destpath.back() != '/') 
-                {
-                    destpath += "/";
-                }
+                    // file header and peers, piece hashes come later in ranges
+                    if (r.rfind("FILE ", 0) != 0) 
+                    { 
+                        cout << r << endl; 
+                        return; 
+                    }
 
-                string fullout = destpath + fname;
-                FILE *outf = fopen(fullout.c_str(), "rb+"); 
-                if (!outf) 
-                {
-                    outf = fopen(fullout.c_str(), "wb+");
-                    if (!outf) 
+                    // parsing file metadata
+                    stringstream s(r); 
+                    long long size = 0; 
+                    string fullhash;
+                    long long num_pieces = 0; 
+                    string word; 
+                    while (s >> word) 
+                    {
+                        if (word == "SIZE") s >> size; 
+                        else if (word == "HASH") s >> fullhash; 
+                        else if (word == "PIECES") s >> num_pieces; 
+                        else if (word == "PEERS") break; 
+                    }
+
+                    // parses available peers, full seeders then partial seeders
+                    size_t pos = r.find("\nPEERS\n"); // find peers
+                    vector<tuple<string,string,string>> peerlist; // peer list
+                    vector<vector<uint8_t>> peerbits; // pieces of each partial seeder, empty for full seeders
+                
+                    if (pos != string::npos) 
+                    {
+                        string peers_block = r.substr(pos + 7); // get block
+                        stringstream sp(peers_block); 
+                        string pname, pip, pport; 
+                        while (sp >> pname && pname != "PARTIAL" && sp >> pip >> pport) 
+                        {
+                            peerlist.emplace_back(pname, pip, pport);
+                            peerbits.emplace_back();
+                        }
+                        // "<name> <ip> <port> <have> <hex bitfield>"
+                        string phave, phex; 
+                        while (sp >> pname >> pip >> pport >> phave >> phex) 
+                        {
+                            if (pname == peername) continue; // our own earlier announces
+                            vector<uint8_t> bits(phex.size() / 2); 
+                            for (size_t i = 0; i < bits.size(); ++i) 
+                            {
+                                bits[i] = (uint8_t)stoi(phex.substr(2 * i, 2), nullptr, 16); 
+                            }
+                            peerlist.emplace_back(pname, pip, pport);
+                            peerbits.push_back(move(bits));
+                        }
+                    }
+
+                    if (peerlist.empty()) 
                     { 
-                        cout << "Failed to create output file: " << fullout << endl; 
+                        cout << "No active peers available for " << fname << ".\n"; 
                         return; 
                     }
-                }
-                // Pre-allocate file size for large files (>2GB support)
-                if (size > 0) 
-                {
-                    if (fseeko(outf, (off_t)(size - 1), SEEK_SET) != 0) 
+
+                    string fullout = destpath + fname;
+                    FILE *outf = fopen(fullout.c_str(), "rb+"); 
+                    if (!outf) 
                     {
-                        cout << "Failed to seek to end of large file (size: " << size << " bytes)\n";
-                        fclose(outf);
-                        return;
+                        outf = fopen(fullout.c_str(), "wb+");
+                        if (!outf) 
+                        { 
+                            cout << "Failed to create output file: " << fullout << endl; 
+                            return; 
+                        }
                     }
-                    if (fputc(0, outf) == EOF) 
+                    // Pre-allocate file size for large files (>2GB support)
+                    if (size > 0) 
                     {
-                        cout << "Failed to write to end of large file\n";
-                        fclose(outf);
-                        return;
+                        if (fseeko(outf, (off_t)(size - 1), SEEK_SET) != 0) 
+                        {
+                            cout << "Failed to seek to end of large file (size: " << size << " bytes)\n";
+                            fclose(outf);
+                            return;
+                        }
+                        if (fputc(0, outf) == EOF) 
+                        {
+                            cout << "Failed to write to end of large file\n";
+                            fclose(outf);
+                            return;
+                        }
                     }
-                }
-                if (fflush(outf) != 0) 
-                {
-                    cout << "Failed to flush file allocation\n";
-                }
-                fclose(outf);
+                    if (fflush(outf) != 0) 
+                    {
+                        cout << "Failed to flush file allocation\n";
+                    }
+                    fclose(outf);
 
-                vector<int> piece_status(num_pieces, 0); // status
-                string statefile = fullout + ".downloading"; // state file
-                FILE *statein = fopen(statefile.c_str(), "rb"); // open state
-                if (statein) 
-                {
-                    for (long long i = 0; i < num_pieces; ++i) 
+                    vector<int> piece_status(num_pieces, 0); // status
+                    string statefile = fullout + ".downloading"; // state file
+                    FILE *statein = fopen(statefile.c_str(), "rb"); // open state
+                    if (statein) 
                     {
-                        int st = 0; 
-                        if (fread(&st, sizeof(int), 1, statein) == 1) piece_status[i] = st;
+                        for (long long i = 0; i < num_pieces; ++i) 
+                        {
+                            int st = 0; 
+                            if (fread(&st, sizeof(int), 1, statein) == 1) piece_status[i] = st;
+                        }
+                        fclose(statein); 
                     }
-                    fclose(statein); 
-                }
 
-                // init download tracking
-                DownloadInfo download_info;
-                download_info.group_id = gid; 
-                download_info.filename = fname; 
-                download_info.dest_path = fullout; 
-                download_info.total_size = size; 
-                download_info.total_pieces = num_pieces; 
-                download_info.completed_pieces = 0; 
-                download_info.piece_status = piece_status; 
-                download_info.piece_hashes = piece_hashes; 
-                download_info.full_hash = fullhash; 
-                download_info.is_active = true; 
-                {
-                    lock_guard<mutex> lock(downloads_mtx); 
-                    active_downloads[fname] = download_info;
-                }
+                    // init download tracking
+                    DownloadInfo download_info;
+                    download_info.group_id = gid; 
+                    download_info.filename = fname; 
+                    download_info.dest_path = fullout; 
+                    download_info.total_size = size; 
+                    download_info.total_pieces = num_pieces; 
+                    download_info.completed_pieces = 0; 
+                    download_info.piece_status = piece_status; 
+                    download_info.full_hash = fullhash; 
+                    download_info.is_active = true; 
+                    {
+                        lock_guard<mutex> lock(downloads_mtx); 
+                        active_downloads[fname] = download_info;
+                    }
 
-                cout << "Starting download of " << fname << " (" << size << " bytes, " << num_pieces << " pieces) from " << peerlist.size() << " peers.\n";
+                    cout << "Starting download of " << fname << " (" << size << " bytes, " << num_pieces << " pieces) from " << peerlist.size() << " peers.\n";
 
-                // thread-safe piece queue and status tracking
-                queue<long long> pending_pieces; // queue
-                for (long long i = 0; i < num_pieces; ++i)
-                { 
-                    if (piece_status[i] != 2) 
+                    // piece hashes arrive in ranges while pieces are already downloading
+                    vector<sha1digest> piece_hashes(num_pieces); // piece hashes
+                    long long hashes_ready = 0; // prefix of piece_hashes fetched
+                    bool hashes_failed = false; // tracker could not give the rest
+                    mutex hash_mtx; 
+                    condition_variable hash_cv; 
+                    const int HASH_RETRIES = 25; // waits for uploader to finish sending hashes
+
+                    // fetching one range from start, returns hashes stored or -1 on error
+                    auto fetch_hashes = [&](long long start) -> long long 
                     {
-                        pending_pieces.push(i);
-                    }
-                }
-                mutex queue_mtx; 
-                const int MAX_RETRIES = 5; // max tries
-                mutex state_mtx; 
-                atomic<long long> completed_count(0); // completed
+                        string resp = sendreadcomd(shardfor(gid), "get_piece_hashes " + gid + " " + fname + " " + peername + " " + to_string(start) + " " + to_string(HASH_RANGE)); 
+                        // "HASHES <start> <count>\n" then count raw digests
+                        size_t nl = resp.find('\n'); 
+                        stringstream hs(resp.substr(0, nl)); 
+                        string tag; 
+                        long long rstart = -1, rcount = 0; 
+                        hs >> tag >> rstart >> rcount; 
+                        if (tag != "HASHES" || rstart != start || rcount <= 0 || rstart + rcount > num_pieces || nl == string::npos || resp.size() - nl - 1 != (size_t)rcount * DIGEST_SIZE) 
+                        {
+                            cout << resp << endl; 
+                            return -1; 
+                        }
+                        const sha1digest *got = (const sha1digest *)(resp.data() + nl + 1); // received digests
+                        long long usable = 0; // hashes uploaded so far
+                        while (usable < rcount && !got[usable].empty()) usable++; 
+                        {
+                            lock_guard<mutex> lock(hash_mtx); 
+                            memcpy(piece_hashes[start].b, got, usable * DIGEST_SIZE); 
+                            hashes_ready = start + usable; 
+                        }
+                        hash_cv.notify_all(); 
+                        return usable; 
+                    };
 
-                // save state helper
-                auto save_state = [&]() 
-                {
-                    FILE *stateout = fopen(statefile.c_str(), "wb"); 
-                    if (!stateout) return; 
+                    // fetching remaining ranges in background
+                    auto fetch_rest = [&]() 
+                    {
+                        int retries = 0; 
+                        while (true) 
+                        {
+                            long long start; 
+                            {
+                                lock_guard<mutex> lock(hash_mtx); 
+                                start = hashes_ready; 
+                            }
+                            if (start >= num_pieces) return; 
+                            long long got = fetch_hashes(start); 
+                            if (got > 0) 
+                            {
+                                retries = 0; 
+                                continue; 
+                            }
+                            if (got < 0 || ++retries > HASH_RETRIES) 
+                            {
+                                cout << "Failed to fetch piece hashes from " << start << " for " << fname << endl; 
+                                {
+                                    lock_guard<mutex> lock(hash_mtx); 
+                                    hashes_failed = true; 
+                                }
+                                hash_cv.notify_all(); 
+                                return; 
+                            }
+                            this_thread::sleep_for(chrono::milliseconds(200)); // uploader still sending hashes
+                        }
+                    };
+                    thread hash_fetcher(fetch_rest); 
+
+                    // thread-safe piece queue and status tracking
+                    queue<long long> pending_pieces; // queue
                     for (long long i = 0; i < num_pieces; ++i)
+                    { 
+                        if (piece_status[i] != 2) 
+                        {
+                            pending_pieces.push(i);
+                        }
+                    }
+                    mutex queue_mtx; 
+                    const int MAX_RETRIES = 5; // max tries
+                    mutex state_mtx; 
+                    atomic<long long> completed_count(0); // completed
+                    vector<pair<int, int>> peer_outcomes(peerlist.size()); // good and failed pieces per peer
+                    vector<bool> peergone(peerlist.size(), false); // seeders that went away meanwhile
+                    mutex peers_mtx; // guards peer lists and outcomes, seeders join while downloading
+
+                    // counting what a peer did for us, reported to the tracker for peer ranking
+                    auto note_peer = [&](int peer_idx, bool ok) 
                     {
-                        fwrite(&piece_status[i], sizeof(int), 1, stateout);
-                    } 
-                    fclose(stateout); 
-                };
+                        lock_guard<mutex> lock(peers_mtx); 
+                        if (ok) peer_outcomes[peer_idx].first++; 
+                        else peer_outcomes[peer_idx].second++; 
+                    };
 
-                // worker function
-                auto worker = [&](int worker_id) 
-                {
-                    // Create peer order with worker-specific preference to avoid contention
-                    vector<int> peer_order(peerlist.size()); // peer order
-                    for (int i = 0; i < (int)peerlist.size(); ++i) 
+                    // save state helper
+                    auto save_state = [&]() 
+                    {
+                        FILE *stateout = fopen(statefile.c_str(), "wb"); 
+                        if (!stateout) return; 
+                        for (long long i = 0; i < num_pieces; ++i)
+                        {
+                            fwrite(&piece_status[i], sizeof(int), 1, stateout);
+                        } 
+                        fclose(stateout); 
+                    };
+
+                    // announcing pieces we have to the tracker so other downloaders can fetch
+                    // them from us before we finish, as deltas since the last announce
+                    vector<long long> unannounced; // completed, not announced yet
+                    for (long long i = 0; i < num_pieces; ++i) 
                     {
-                        peer_order[i] = i;
+                        if (piece_status[i] == 2) unannounced.push_back(i); // resumed download
                     }
-                    // start each worker from a different peer to distribute load
-                    rotate(peer_order.begin(), peer_order.begin() + (worker_id % peerlist.size()), peer_order.end()); // rotate
-                    
-                    while (true) 
+                    mutex announce_mtx; 
+                    auto last_announce = chrono::steady_clock::now(); 
+                    auto announce = [&](bool force) 
                     {
-                        long long piece_idx = -1; // piece index
+                        vector<long long> batch; 
                         {
-                            lock_guard<mutex> lock(queue_mtx);
-                            if (!pending_pieces.empty()) {
-                                piece_idx = pending_pieces.front(); 
-                                pending_pieces.pop();
-                            }
+                            lock_guard<mutex> lock(announce_mtx); 
+                            auto now = chrono::steady_clock::now(); 
+                            if (unannounced.empty() || (!force && now - last_announce < chrono::seconds(ANNOUNCE_SECONDS))) return; 
+                            last_announce = now; 
+                            batch.swap(unannounced); 
+                        }
+                        vector<string> cmds; // have_pieces in batches
+                        for (size_t i = 0; i < batch.size(); i += ANNOUNCE_BATCH) 
+                        {
+                            string cmd = "have_pieces " + gid + " " + fname + " " + peername; 
+                            for (size_t j = i; j < batch.size() && j < i + ANNOUNCE_BATCH; ++j) cmd += " " + to_string(batch[j]); 
+                            cmds.push_back(cmd); 
                         }
-                        if (piece_idx == -1) return; 
+                        sendcomds(shardfor(gid), cmds); 
+                    };
+                    announce(true); 
 
+                    // worker function, starting on peer first_peer
+                    auto worker = [&](int first_peer) 
+                    {
+                        vector<int> peer_order; // peer order, taken again for every piece as seeders come and go
+                    
+                        while (true) 
                         {
-                            lock_guard<mutex> lock(downloads_mtx);
-                            if (active_downloads.find(fname) != active_downloads.end()) 
+                            long long piece_idx = -1; // piece index
                             {
-                                active_downloads[fname].piece_status[piece_idx] = 1;
+                                lock_guard<mutex> lock(queue_mtx);
+                                if (!pending_pieces.empty()) {
+                                    piece_idx = pending_pieces.front(); 
+                                    pending_pieces.pop();
+                                }
                             }
-                        }
-                        piece_status[piece_idx] = 1; // set downloading
-                        save_state();
+                            if (piece_idx == -1) return; 
 
-                        int attempt = 0; // tries
-                        bool success = false; // success
+                            {
+                                lock_guard<mutex> lock(downloads_mtx);
+                                if (active_downloads.find(fname) != active_downloads.end()) 
+                                {
+                                    active_downloads[fname].piece_status[piece_idx] = 1;
+                                }
+                            }
+                            piece_status[piece_idx] = 1; // set downloading
+                            save_state();
 
-                        while (attempt < MAX_RETRIES && !success) 
-                        {
-                            for (int peer_idx : peer_order) 
+                            // waiting till this piece's hash has been fetched
+                            bool have_hash; 
                             {
-                                auto &p = peerlist[peer_idx]; 
-                                string pip, pport, pname;
-                                tie(pname, pip, pport) = p; 
+                                unique_lock<mutex> lock(hash_mtx); 
+                                hash_cv.wait(lock, [&] { return piece_idx < hashes_ready || hashes_failed; }); 
+                                have_hash = piece_idx < hashes_ready; 
+                            }
 
-                                int psock = socket(AF_INET, SOCK_STREAM, 0); 
-                                if (psock < 0) continue; 
+                            int attempt = have_hash ? 0 : MAX_RETRIES; // tries
+                            bool success = false; // success
 
-                                struct sockaddr_in addr; 
-                                addr.sin_family = AF_INET; 
-                                addr.sin_port = htons(stoi(pport)); 
-                                if (inet_pton(AF_INET, pip.c_str(), &addr.sin_addr) <= 0) 
+                            while (attempt < MAX_RETRIES && !success) 
+                            {
                                 {
-                                    close(psock);
-                                    continue;
+                                    // the tracker lists peers best first, so workers start on the best ones
+                                    // start each worker from a different peer to distribute load
+                                    lock_guard<mutex> lock(peers_mtx); 
+                                    peer_order.resize(peerlist.size()); 
+                                    for (int i = 0; i < (int)peerlist.size(); ++i) 
+                                    {
+                                        peer_order[i] = i;
+                                    }
+                                    rotate(peer_order.begin(), peer_order.begin() + (first_peer % peerlist.size()), peer_order.end()); // rotate
                                 }
+                                for (int peer_idx : peer_order) 
+                                {
+                                    string pip, pport, pname;
+                                    {
+                                        lock_guard<mutex> lock(peers_mtx); 
+                                        auto &bits = peerbits[peer_idx]; 
+                                        if (peergone[peer_idx]) continue; // stopped seeding
+                                        if (!bits.empty() && (piece_idx / 8 >= (long long)bits.size() || !(bits[piece_idx / 8] & (0x80 >> (piece_idx % 8))))) 
+                                        {
+                                            continue; // partial seeder without this piece
+                                        }
+                                        tie(pname, pip, pport) = peerlist[peer_idx]; 
+                                    }
 
-                                //  timeout for large pieces (512KB can take time on slow connections)
-                                struct timeval tv = {30, 0}; // 30 second timeout
-                                setsockopt(psock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv)); // set timeout
-                                setsockopt(psock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv)); // set timeout
+                                    int psock = socket(AF_INET, SOCK_STREAM, 0); 
+                                    if (psock < 0) continue; 
 
-                                if (connect(psock, (struct sockaddr *)&addr, sizeof(addr)) < 0) 
-                                {
-                                    close(psock);
-                                    continue;
-                                }
+                                    struct sockaddr_in addr; 
+                                    addr.sin_family = AF_INET; 
+                                    addr.sin_port = htons(stoi(pport)); 
+                                    if (inet_pton(AF_INET, pip.c_str(), &addr.sin_addr) <= 0) 
+                                    {
+                                        close(psock);
+                                        continue;
+                                    }
 
-                                string preq = "GET_PIECE " + fname + " " + to_string(piece_idx);
-                                if (send(psock, preq.c_str(), preq.size(), 0) < 0) 
-                                {
-                                    close(psock);
-                                    continue;
-                                }
+                                    //  timeout for large pieces (512KB can take time on slow connections)
+                                    struct timeval tv = {30, 0}; // 30 second timeout
+                                    setsockopt(psock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv)); // set timeout
+                                    setsockopt(psock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv)); // set timeout
 
-                                uint32_t piece_size;
-                                if (!read_all(psock, (char*)&piece_size, sizeof(piece_size))) 
-                                { 
-                                    close(psock); 
-                                    continue; 
-                                }
-                                piece_size = ntohl(piece_size); 
-                                if (piece_size > PIECE_SIZE) 
-                                { 
-                                    close(psock); 
-                                    continue; 
-                                }
+                                    if (connect(psock, (struct sockaddr *)&addr, sizeof(addr)) < 0) 
+                                    {
+                                        close(psock);
+                                        note_peer(peer_idx, false);
+                                        continue;
+                                    }
 
-                                vector<char> buffer(piece_size); 
-                                if (!read_all(psock, buffer.data(), piece_size)) 
-                                { 
-                                    close(psock); 
-                                    continue; 
-                                }   
-                                close(psock);
-
-                                EVP_MD_CTX *ctx = EVP_MD_CTX_new(); // hash context
-                                EVP_DigestInit_ex(ctx, EVP_sha1(), NULL); // init hash
-                                EVP_DigestUpdate(ctx, buffer.data(), piece_size); // update hash
-                                unsigned char hash[EVP_MAX_MD_SIZE];
-                                unsigned int hlen;
-                                EVP_DigestFinal_ex(ctx, hash, &hlen); // finish hash
-                                EVP_MD_CTX_free(ctx); // free context
-
-                                char hex[41];
-                                for (unsigned int i=0;i<hlen;i++) sprintf(hex+i*2,"%02x",hash[i]);
-                                hex[40]=0;
-                                string recv_hex(hex); // get hash
-
-                                if (recv_hex != piece_hashes[piece_idx]) {
-                                    cout << "[Piece " << piece_idx << "] Hash mismatch! Expected: " << piece_hashes[piece_idx] << ", Got: " << recv_hex << endl;
-                                    attempt++;
-                                    continue;
-                                }
+                                    // by content, the peer may have it under another name in another group
+                                    string preq = "GET_PIECE " + fullhash + " " + to_string(piece_idx);
+                                    if (send(psock, preq.c_str(), preq.size(), 0) < 0) 
+                                    {
+                                        close(psock);
+                                        note_peer(peer_idx, false);
+                                        continue;
+                                    }
 
-                                FILE *fw = fopen(fullout.c_str(), "rb+");
-                                if (!fw) 
-                                { 
-                                    cout << "[Piece " << piece_idx << "] Failed to open output file for writing\n";
-                                    attempt++; 
-                                    continue; 
-                                }
+                                    uint32_t piece_size;
+                                    if (!read_all(psock, (char*)&piece_size, sizeof(piece_size))) 
+                                    { 
+                                        close(psock); 
+                                        note_peer(peer_idx, false);
+                                        continue; 
+                                    }
+                                    piece_size = ntohl(piece_size); 
+                                    if (piece_size > PIECE_SIZE) 
+                                    { 
+                                        close(psock); 
+                                        note_peer(peer_idx, false);
+                                        continue; 
+                                    }
+
+                                    vector<char> buffer(piece_size); 
+                                    if (!read_all(psock, buffer.data(), piece_size)) 
+                                    { 
+                                        close(psock); 
+                                        note_peer(peer_idx, false);
+                                        continue; 
+                                    }   
+                                    close(psock);
+
+                                    sha1digest recv_hash = piecedigest(buffer.data(), piece_size); // get hash
+
+                                    if (recv_hash != piece_hashes[piece_idx]) {
+                                        cout << "[Piece " << piece_idx << "] Hash mismatch! Expected: " << digesttohex(piece_hashes[piece_idx]) << ", Got: " << digesttohex(recv_hash) << endl;
+                                        note_peer(peer_idx, false);
+                                        attempt++;
+                                        continue;
+                                    }
+                                    note_peer(peer_idx, true);
+
+                                    FILE *fw = fopen(fullout.c_str(), "rb+");
+                                    if (!fw) 
+                                    { 
+                                        cout << "[Piece " << piece_idx << "] Failed to open output file for writing\n";
+                                        attempt++; 
+                                        continue; 
+                                    }
                                 
-                                // Use fseeko for large file support (>2GB)
-                                off_t offset = (off_t)piece_idx * PIECE_SIZE; // offset
-                                if (fseeko(fw, offset, SEEK_SET) != 0) 
-                                {
-                                    cout << "[Piece " << piece_idx << "] Failed to seek to position " << offset << "\n";
-                                    fclose(fw);
-                                    attempt++;
-                                    continue;
-                                }
+                                    // Use fseeko for large file support (>2GB)
+                                    off_t offset = (off_t)piece_idx * PIECE_SIZE; // offset
+                                    if (fseeko(fw, offset, SEEK_SET) != 0) 
+                                    {
+                                        cout << "[Piece " << piece_idx << "] Failed to seek to position " << offset << "\n";
+                                        fclose(fw);
+                                        attempt++;
+                                        continue;
+                                    }
                                 
-                                size_t written = fwrite(buffer.data(), 1, piece_size, fw); // write
-                                if (written != piece_size) 
-                                {
-                                    cout << "[Piece " << piece_idx << "] Failed to write complete piece. Expected: " << piece_size << ", Written: " << written << "\n";
-                                    fclose(fw);
-                                    attempt++;
-                                    continue;
-                                }
+                                    size_t written = fwrite(buffer.data(), 1, piece_size, fw); // write
+                                    if (written != piece_size) 
+                                    {
+                                        cout << "[Piece " << piece_idx << "] Failed to write complete piece. Expected: " << piece_size << ", Written: " << written << "\n";
+                                        fclose(fw);
+                                        attempt++;
+                                        continue;
+                                    }
                                 
-                                if (fflush(fw) != 0) 
-                                {
-                                    cout << "[Piece " << piece_idx << "] Failed to flush data to disk\n";
+                                    if (fflush(fw) != 0) 
+                                    {
+                                        cout << "[Piece " << piece_idx << "] Failed to flush data to disk\n";
+                                        fclose(fw);
+                                        attempt++;
+                                        continue;
+                                    }
                                     fclose(fw);
-                                    attempt++;
-                                    continue;
-                                }
-                                fclose(fw);
 
-                                {
-                                    lock_guard<mutex> lk(state_mtx); 
-                                    lock_guard<mutex> dl_lock(downloads_mtx); 
-                                    if (active_downloads.find(fname) != active_downloads.end()) 
                                     {
-                                        active_downloads[fname].piece_status[piece_idx] = 2;
-                                        active_downloads[fname].completed_pieces++;
+                                        lock_guard<mutex> lk(state_mtx); 
+                                        lock_guard<mutex> dl_lock(downloads_mtx); 
+                                        if (active_downloads.find(fname) != active_downloads.end()) 
+                                        {
+                                            active_downloads[fname].piece_status[piece_idx] = 2;
+                                            active_downloads[fname].completed_pieces++;
+                                        }
                                     }
-                                }
-                                piece_status[piece_idx] = 2; // set completed
-                                save_state();
+                                    piece_status[piece_idx] = 2; // set completed
+                                    save_state();
+                                    {
+                                        lock_guard<mutex> lock(announce_mtx); 
+                                        unannounced.push_back(piece_idx); 
+                                    }
+                                    announce(false); 
 
-                                completed_count++; // add completed
-                                long long progress_pct = (completed_count * 100) / num_pieces;
-                                cout << "[Piece " << piece_idx << "] Downloaded successfully from " << pip << ":" << pport << " (" << completed_count << "/" << num_pieces << " = " << progress_pct << "%)\n";
+                                    completed_count++; // add completed
+                                    long long progress_pct = (completed_count * 100) / num_pieces;
+                                    cout << "[Piece " << piece_idx << "] Downloaded successfully from " << pip << ":" << pport << " (" << completed_count << "/" << num_pieces << " = " << progress_pct << "%)\n";
                                 
-                                // report progress at milestones for large files
-                                if (num_pieces > 100 && completed_count % (num_pieces / 10) == 0) 
-                                {
-                                    cout << "*** Download Progress: " << progress_pct << "% complete ***\n";
+                                    // report progress at milestones for large files
+                                    if (num_pieces > 100 && completed_count % (num_pieces / 10) == 0) 
+                                    {
+                                        cout << "*** Download Progress: " << progress_pct << "% complete ***\n";
+                                    }
+                                    success = true;
+                                    break;
                                 }
-                                success = true;
-                                break;
+                                if (!success) attempt++;
                             }
-                            if (!success) attempt++;
-                        }
 
-                        if (!success) {
-                            cout << "[Piece " << piece_idx << "] Failed after " << MAX_RETRIES << " attempts.\n";
-                            {
-                                lock_guard<mutex> lock(downloads_mtx);
-                                if (active_downloads.find(fname) != active_downloads.end()) 
+                            if (!success) {
+                                cout << "[Piece " << piece_idx << "] Failed after " << MAX_RETRIES << " attempts.\n";
                                 {
-                                    active_downloads[fname].piece_status[piece_idx] = 3; // set failed
+                                    lock_guard<mutex> lock(downloads_mtx);
+                                    if (active_downloads.find(fname) != active_downloads.end()) 
+                                    {
+                                        active_downloads[fname].piece_status[piece_idx] = 3; // set failed
+                                    }
                                 }
+                                piece_status[piece_idx] = 3; // set failed
+                                save_state();
                             }
-                            piece_status[piece_idx] = 3; // set failed
-                            save_state();
                         }
-                    }
-                };
+                    };
 
-                // limits workers for very large files to prevent memory/resource exhaustion
-                int max_workers = (num_pieces > 1000) ? min(4, (int)peerlist.size()) : min((int)peerlist.size(), 8); // workers
-                int num_workers = max_workers; // workers
+                    // limits workers for very large files to prevent memory/resource exhaustion
+                    int worker_cap = (num_pieces > 1000) ? 4 : 8; // most workers, seeders joining later add workers up to it
+                    int max_workers = min(worker_cap, (int)peerlist.size()); // workers
+                    int num_workers = max_workers; // workers
                 
-                cout << "Using " << num_workers << " download workers for " << num_pieces << " pieces\n";
+                    cout << "Using " << num_workers << " download workers for " << num_pieces << " pieces\n";
                 
-                vector<thread> dthreads; // threads
-                for (int i=0;i<num_workers;i++)
-                {
-                    dthreads.emplace_back(worker,i); // start threads
-                } 
-                for (auto &t:dthreads) 
-                {
-                    if (t.joinable()) 
+                    vector<thread> dthreads; // threads, guarded by peers_mtx
+                    bool workers_done = false; // no worker is started after this
                     {
-                        t.join(); // join
+                        lock_guard<mutex> lock(peers_mtx); 
+                        for (int i=0;i<num_workers;i++)
+                        {
+                            dthreads.emplace_back(worker,i); // start threads
+                        } 
                     }
-                }
 
-                // final verification
-                bool all_completed = true; 
-                {
-                    lock_guard<mutex> lock(downloads_mtx);
-                    if (active_downloads.find(fname) != active_downloads.end()) 
+                    // seeders coming online while we download become sources right away,
+                    // ones going away are skipped. the tracker pushes both to our subscription
+                    auto onseeder = [&](const vector<string> &ev) 
+                    {
+                        lock_guard<mutex> lock(peers_mtx); 
+                        if (ev.size() < 3 || ev[2] == peername) return; 
+                        size_t i = 0; 
+                        while (i < peerlist.size() && get<0>(peerlist[i]) != ev[2]) i++; 
+                        if (ev[0] == "SEEDER_LEFT") 
+                        {
+                            if (i < peerlist.size()) peergone[i] = true; 
+                            return; 
+                        }
+                        if (ev.size() != 5) return; 
+                        bool added = i == peerlist.size(); // new source
+                        if (added) 
+                        {
+                            peerlist.emplace_back(ev[2], ev[3], ev[4]); 
+                            peerbits.emplace_back(); 
+                            peer_outcomes.emplace_back(0, 0); 
+                            peergone.push_back(false); 
+                        } 
+                        else 
+                        {
+                            peerlist[i] = make_tuple(ev[2], ev[3], ev[4]); // maybe a new address
+                            peerbits[i].clear(); // has every piece now
+                            peergone[i] = false; 
+                        }
+                        cout << "[" << fname << "] Seeder " << ev[2] << " available at " << ev[3] << ":" << ev[4] << endl; 
+                        if (added && !workers_done && (int)dthreads.size() < worker_cap) dthreads.emplace_back(worker, (int)i); 
+                    };
+                    string sub = "subscribe " + peername + " file " + gid + " " + fname; // seeder events
+                    {
+                        lock_guard<mutex> lock(watchmtx); 
+                        seederwatch[fullhash][fname] = onseeder; 
+                    }
+                    subscribe(shardfor(gid), sub); 
+
+                    for (size_t joined = 0; ; joined++) 
                     {
-                        for (long long i=0;i<num_pieces;i++) 
+                        thread t; 
                         {
-                            if (active_downloads[fname].piece_status[i] != 2) 
+                            lock_guard<mutex> lock(peers_mtx); 
+                            if (joined == dthreads.size()) 
                             {
-                                all_completed = false; // not completed
-                                break;
+                                workers_done = true; 
+                                break; 
                             }
+                            t = move(dthreads[joined]); 
                         }
+                        t.join(); // join
                     }
-                }
+                    {
+                        lock_guard<mutex> lock(watchmtx); // waits out a handler still running
+                        seederwatch[fullhash].erase(fname); 
+                        if (seederwatch[fullhash].empty()) seederwatch.erase(fullhash); 
+                    }
+                    unsubscribe(shardfor(gid), sub); 
+                    hash_fetcher.join(); 
 
-                if (!all_completed) 
-                {
-                    cout << "Download incomplete: some pieces failed.\n";
+                    // telling tracker how each peer did, so later peer lists start from good ones
+                    string report = "report_peers " + peername; 
+                    bool reported = false; // any peer asked at all
+                    for (size_t i = 0; i < peerlist.size(); ++i) 
+                    {
+                        if (peer_outcomes[i].first + peer_outcomes[i].second == 0) continue; // never asked
+                        report += " " + get<0>(peerlist[i]) + " " + to_string(peer_outcomes[i].first) + " " + to_string(peer_outcomes[i].second); 
+                        reported = true; 
+                    }
+                    if (reported) sendcomd(shardfor(gid), report); // peers are ranked where the group is
+                    {
+                        lock_guard<mutex> lock(downloads_mtx); 
+                        if (active_downloads.find(fname) != active_downloads.end()) 
+                        {
+                            active_downloads[fname].piece_hashes = piece_hashes; 
+                        }
+                    }
+
+                    // final verification
+                    bool all_completed = true; 
                     {
                         lock_guard<mutex> lock(downloads_mtx);
                         if (active_downloads.find(fname) != active_downloads.end()) 
                         {
-                            active_downloads[fname].is_active = false; // set inactive
+                            for (long long i=0;i<num_pieces;i++) 
+                            {
+                                if (active_downloads[fname].piece_status[i] != 2) 
+                                {
+                                    all_completed = false; // not completed
+                                    break;
+                                }
+                            }
                         }
                     }
-                    save_state();
-                    return;
-                }
 
-                // full file hash verification
-                string dhash = filehash(fullout); // get hash
-                if (dhash == fullhash) 
-                {
-                    cout << "[C] " << gid << " " << fname << " downloaded successfully.\n";
+                    if (!all_completed) 
+                    {
+                        cout << "Download incomplete: some pieces failed.\n";
+                        announce(true); // still serving what we have
+                        {
+                            lock_guard<mutex> lock(downloads_mtx);
+                            if (active_downloads.find(fname) != active_downloads.end()) 
+                            {
+                                active_downloads[fname].is_active = false; // set inactive
+                            }
+                        }
+                        save_state();
+                        return;
+                    }
+
+                    // full file hash verification
+                    string dhash = filehash(fullout); // get hash
+                    if (dhash == fullhash) 
+                    {
+                        cout << "[C] " << gid << " " << fname << " downloaded successfully.\n";
                     
-                    // add downloaded file to uploaded_files so this peer can now serve it to others
-                    uploaded_files[fname] = fullout;
+                        // add downloaded file to uploaded_files so this peer can now serve it to others
+                        {
+                            lock_guard<mutex> lock(downloads_mtx); // several downloads may finish at once
+                            uploaded_files[fname] = fullout;
+                            shared_contents[fullhash] = fullout;
+                        }
                     
-                    // tell tracker that this peer now has the file so other peers can download
-                    string notify_cmd = "file_downloaded " + gid + " " + fname + " " + peername; 
-                    string tracker_response = sendcomd(serversock, notify_cmd); 
+                        // tell tracker that this peer now has the file so other peers can download
+                        string notify_cmd = "file_downloaded " + gid + " " + fname + " " + peername; 
+                        string tracker_response = sendcomd(shardfor(gid), notify_cmd); 
                     
-                    {
-                        lock_guard<mutex> lock(downloads_mtx); 
-                        if (active_downloads.find(fname) != active_downloads.end()) 
                         {
-                            active_downloads[fname].is_active = false; // set inactive
+                            lock_guard<mutex> lock(downloads_mtx); 
+                            if (active_downloads.find(fname) != active_downloads.end()) 
+                            {
+                                active_downloads[fname].is_active = false; // set inactive
+                            }
                         }
-                    }
-                    remove(statefile.c_str());
-                } 
-                else 
-                {
-                    cout << "Full-file hash mismatch! Expected " << fullhash << " got " << dhash << endl;
+                        remove(statefile.c_str());
+                    } 
+                    else 
                     {
-                        lock_guard<mutex> lock(downloads_mtx); // lock
-                        if (active_downloads.find(fname) != active_downloads.end()) 
+                        cout << "Full-file hash mismatch! Expected " << fullhash << " got " << dhash << endl;
                         {
-                            active_downloads[fname].is_active = false; // set inactive
+                            lock_guard<mutex> lock(downloads_mtx); // lock
+                            if (active_downloads.find(fname) != active_downloads.end()) 
+                            {
+                                active_downloads[fname].is_active = false; // set inactive
+                            }
                         }
+                        save_state();
                     }
-                    save_state();
+                };
+
+                // files download side by side, sharing the tracker connection
+                vector<thread> files; // one per file
+                for (size_t i = 0; i < fnames.size(); ++i) 
+                {
+                    files.emplace_back(downloadone, fnames[i], infos[i]); 
                 }
+                for (auto &t : files) t.join(); 
             });
         };
 
@@ -1178,10 +1928,11 @@ int main(int argc, char *argv[])
         // handle exit
         if (cmds[0] == "exit") {
             cout << "------- Exiting Client ---------" << endl; 
-            if (serversock > 0)
+            for (auto &s : shards) 
             {
-                close(serversock);
-            } 
+                s->tracker.stop(); // closing tracker connections
+                s->readtracker.stop(); 
+            }
                 
             noaccept = true; // set flag
             shutdown(listenSock, SHUT_RDWR); 
@@ -0,0 +1,155 @@
+#ifndef RPC_H
+#define RPC_H
+
+// asynchronous request/response over one tracker connection
+// every command goes out as a FRAME_REQUEST with its own id and the tracker
+// echoes the id on the FRAME_RESPONSE, so any number of threads can have
+// requests outstanding on the same connection and each one completes when
+// its own reply arrives, in whatever order that happens
+//
+// a batch of commands is written in one go, so N lookups cost one round trip
+// events the tracker pushes to our subscriptions arrive on the same connection
+// and are handed to onevent
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include "../common/frame.h"
+
+using namespace std;
+
+// outcome of one request, ok is false when the connection broke before the reply
+struct rpcreply
+{
+    bool ok = false;
+    string msg;
+};
+
+class trackerrpc
+{
+    framedsocket conn;  // reader thread reads, callers write under wmtx
+    mutex wmtx;         // one batch written at a time
+    mutex pmtx;         // guards pending, nextid and live
+    unordered_map<uint32_t, promise<rpcreply>> pending; // waiting for reply
+    uint32_t nextid = 1;    // next request id
+    bool live = false;      // reader running, new requests accepted
+    thread reader;          // completing requests as replies come in
+
+    // failing every outstanding request, connection is gone
+    void failpending()
+    {
+        lock_guard<mutex> lock(pmtx);
+        live = false;
+        for (auto &it : pending) it.second.set_value(rpcreply());
+        pending.clear();
+    }
+
+    void readloop()
+    {
+        uint8_t type;
+        string payload;
+        while (conn.recvframe(type, payload))
+        {
+            uint32_t id;
+            if (type == FRAME_EVENT)
+            {
+                if (onevent) onevent(payload);
+                continue;
+            }
+            if (type != FRAME_RESPONSE || !taggedid(payload, id)) continue; // ignoring untagged frames
+            rpcreply r;
+            r.ok = true;
+            r.msg = payload.substr(REQUEST_ID_SIZE);
+
+            lock_guard<mutex> lock(pmtx);
+            auto it = pending.find(id);
+            if (it == pending.end()) continue; // nobody waiting
+            it->second.set_value(move(r));
+            pending.erase(it);
+        }
+        failpending();
+    }
+
+public:
+    function<void(const string &)> onevent; // pushed events, run on the reader thread, set before start
+
+    ~trackerrpc() { stop(); }
+
+    // taking over a connected socket and starting the reader
+    void start(int sock)
+    {
+        stop();
+        {
+            lock_guard<mutex> wlock(wmtx);
+            conn.setsock(sock);
+        }
+        {
+            lock_guard<mutex> lock(pmtx);
+            live = true;
+        }
+        reader = thread(&trackerrpc::readloop, this);
+    }
+
+    // closing the connection, outstanding requests fail
+    void stop()
+    {
+        if (conn.fd() >= 0) shutdown(conn.fd(), SHUT_RDWR); // unblocks reader and writers
+        if (reader.joinable()) reader.join();
+        lock_guard<mutex> wlock(wmtx);
+        if (conn.fd() >= 0) close(conn.fd());
+        conn.setsock(-1);
+    }
+
+    bool connected()
+    {
+        lock_guard<mutex> lock(pmtx);
+        return live;
+    }
+
+    // sending commands in one write, one future per command
+    vector<future<rpcreply>> call(const vector<string> &cmds)
+    {
+        vector<future<rpcreply>> replies;
+        lock_guard<mutex> wlock(wmtx);
+        {
+            lock_guard<mutex> lock(pmtx);
+            for (auto &cmd : cmds)
+            {
+                promise<rpcreply> p;
+                replies.push_back(p.get_future());
+                if (!live)
+                {
+                    p.set_value(rpcreply()); // connection already gone
+                    continue;
+                }
+                uint32_t id = nextid++;
+                pending.emplace(id, move(p));
+                conn.queuetagged(FRAME_REQUEST, id, cmd);
+            }
+        }
+        if (!conn.flush()) shutdown(conn.fd(), SHUT_RDWR); // reader fails what is pending
+        return replies;
+    }
+
+    future<rpcreply> call(const string &cmd)
+    {
+        return move(call(vector<string>{cmd})[0]);
+    }
+
+    // sending commands and waiting for every reply
+    vector<rpcreply> callall(const vector<string> &cmds)
+    {
+        vector<future<rpcreply>> futures = call(cmds);
+        vector<rpcreply> replies;
+        for (auto &f : futures) replies.push_back(f.get());
+        return replies;
+    }
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+// fixed size SHA1 digest kept as raw bytes
+// piece hashes are stored in contiguous vector<sha1digest> on both ends and
+// travel in binary on the wire, hex is only used for display and for the
+// old text commands
+
+#include <string.h>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+const size_t DIGEST_SIZE = 20; // SHA1 output
+const size_t PIECE_SIZE = 512 * 1024; // bytes one piece hash covers, the last piece may be shorter
+
+struct sha1digest
+{
+    unsigned char b[DIGEST_SIZE] = {0};
+
+    bool operator==(const sha1digest &o) const { return memcmp(b, o.b, DIGEST_SIZE) == 0; }
+    bool operator!=(const sha1digest &o) const { return !(*this == o); }
+
+    // all zero means not known yet (e.g. uploader has not sent this range)
+    bool empty() const
+    {
+        static const sha1digest zero;
+        return *this == zero;
+    }
+};
+
+static_assert(sizeof(sha1digest) == DIGEST_SIZE, "digests must pack contiguously");
+
+inline int hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// parsing 40 hex chars, false if malformed
+inline bool hextodigest(string_view hex, sha1digest &out)
+{
+    if (hex.size() != DIGEST_SIZE * 2) return false;
+    for (size_t i = 0; i < DIGEST_SIZE; i++)
+    {
+        int hi = hexval(hex[2 * i]), lo = hexval(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out.b[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return true;
+}
+
+// appending hex of b to out, replies build on this without temporaries
+inline void appendhex(string &out, const unsigned char *b, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++)
+    {
+        out.push_back(digits[b[i] >> 4]);
+        out.push_back(digits[b[i] & 15]);
+    }
+}
+
+inline string digesttohex(const unsigned char *b, size_t len)
+{
+    string hex; // result
+    hex.reserve(len * 2);
+    appendhex(hex, b, len);
+    return hex;
+}
+
+inline string digesttohex(const sha1digest &d)
+{
+    return digesttohex(d.b, DIGEST_SIZE);
+}
+
+#endif
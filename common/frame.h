@@ -0,0 +1,238 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+// length-prefixed framing for the client <-> tracker connection
+// every message is [4-byte payload length, network order][1-byte type][payload]
+// so a large message streams across many reads and several small messages
+// can share one read or one write
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+enum frametype : uint8_t
+{
+    FRAME_COMMAND = 1,  // client -> tracker command
+    FRAME_REPLY = 2,    // tracker -> client reply
+    FRAME_LOG = 3,      // primary -> standby log record, [u64 seq][payload]
+    FRAME_SNAPSHOT = 4, // primary -> standby snapshot chunk, empty one ends it
+    FRAME_REQUEST = 5,  // client -> tracker command tagged with a request id
+    FRAME_RESPONSE = 6, // tracker -> client reply carrying the request id back
+    FRAME_EVENT = 7,    // tracker -> client event pushed to a subscriber, untagged
+};
+
+const size_t REQUEST_ID_SIZE = 4; // id at the start of request/response payloads
+
+const size_t FRAME_HEADER = 5;                  // length + type
+const uint32_t MAX_FRAME = 64 * 1024 * 1024;    // refusing anything bigger
+const size_t READ_CHUNK = 64 * 1024;            // bytes asked from socket per read
+
+enum framestatus
+{
+    FRAME_OK,       // complete frame taken
+    FRAME_PARTIAL,  // need more bytes
+    FRAME_TOOBIG,   // length over MAX_FRAME, stream is unusable
+};
+
+// appending one frame to an output buffer
+inline void appendframe(string &buf, uint8_t type, const char *data, size_t len)
+{
+    uint32_t netlen = htonl((uint32_t)len); // length
+    buf.append((const char *)&netlen, sizeof(netlen));
+    buf.push_back((char)type);
+    buf.append(data, len);
+}
+
+inline void appendframe(string &buf, uint8_t type, const string &payload)
+{
+    appendframe(buf, type, payload.data(), payload.size());
+}
+
+// appending a request or response frame, payload is [4-byte id, network order][body]
+inline void appendtagged(string &buf, uint8_t type, uint32_t id, const char *data, size_t len)
+{
+    uint32_t netlen = htonl((uint32_t)(REQUEST_ID_SIZE + len)); // length
+    uint32_t netid = htonl(id); // request id
+    buf.append((const char *)&netlen, sizeof(netlen));
+    buf.push_back((char)type);
+    buf.append((const char *)&netid, sizeof(netid));
+    buf.append(data, len);
+}
+
+// starting a frame whose payload is appended straight after, returns where
+// it starts for endframe to fill in the length. tagged frames get their id
+inline size_t beginframe(string &buf, uint8_t type)
+{
+    size_t at = buf.size(); // frame start
+    buf.append(sizeof(uint32_t), '\0');
+    buf.push_back((char)type);
+    return at;
+}
+
+inline size_t begintagged(string &buf, uint8_t type, uint32_t id)
+{
+    size_t at = beginframe(buf, type); // frame start
+    uint32_t netid = htonl(id); // request id
+    buf.append((const char *)&netid, sizeof(netid));
+    return at;
+}
+
+// closing frame started at at, everything appended since is its payload
+inline void endframe(string &buf, size_t at)
+{
+    uint32_t netlen = htonl((uint32_t)(buf.size() - at - FRAME_HEADER)); // length
+    memcpy(&buf[at], &netlen, sizeof(netlen));
+}
+
+// splitting id off a request or response payload, false if too short
+inline bool taggedid(string_view payload, uint32_t &id)
+{
+    if (payload.size() < REQUEST_ID_SIZE) return false;
+    uint32_t netid;
+    memcpy(&netid, payload.data(), sizeof(netid));
+    id = ntohl(netid);
+    return true;
+}
+
+// taking the next complete frame from buf at off, advancing off past it
+inline framestatus nextframe(const string &buf, size_t &off, uint8_t &type, string &payload)
+{
+    if (buf.size() - off < FRAME_HEADER) return FRAME_PARTIAL;
+    uint32_t netlen;
+    memcpy(&netlen, buf.data() + off, sizeof(netlen));
+    uint32_t len = ntohl(netlen); // payload length
+    if (len > MAX_FRAME) return FRAME_TOOBIG;
+    if (buf.size() - off - FRAME_HEADER < len) return FRAME_PARTIAL;
+
+    type = (uint8_t)buf[off + 4];
+    payload.assign(buf, off + FRAME_HEADER, len);
+    off += FRAME_HEADER + len;
+    return FRAME_OK;
+}
+
+// same without copying, payload points into buf until buf changes
+inline framestatus nextframe(const string &buf, size_t &off, uint8_t &type, string_view &payload)
+{
+    if (buf.size() - off < FRAME_HEADER) return FRAME_PARTIAL;
+    uint32_t netlen;
+    memcpy(&netlen, buf.data() + off, sizeof(netlen));
+    uint32_t len = ntohl(netlen); // payload length
+    if (len > MAX_FRAME) return FRAME_TOOBIG;
+    if (buf.size() - off - FRAME_HEADER < len) return FRAME_PARTIAL;
+
+    type = (uint8_t)buf[off + 4];
+    payload = string_view(buf.data() + off + FRAME_HEADER, len);
+    off += FRAME_HEADER + len;
+    return FRAME_OK;
+}
+
+// blocking buffered reader/writer over one socket
+class framedsocket
+{
+    int sock = -1;
+    string rbuf;        // bytes read but not consumed
+    size_t roff = 0;    // consumed prefix of rbuf
+    string wbuf;        // frames queued for writing
+
+public:
+    void setsock(int s)
+    {
+        sock = s;
+        rbuf.clear();
+        roff = 0;
+        wbuf.clear();
+    }
+
+    int fd() const { return sock; }
+
+    // queueing a frame, nothing is written until flush
+    void queue(uint8_t type, const string &payload)
+    {
+        appendframe(wbuf, type, payload);
+    }
+
+    // queueing frames already encoded by the caller
+    void queueframes(const string &frames)
+    {
+        wbuf += frames;
+    }
+
+    void queuetagged(uint8_t type, uint32_t id, const string &payload)
+    {
+        appendtagged(wbuf, type, id, payload.data(), payload.size());
+    }
+
+    // writing every queued frame, as few syscalls as the socket allows
+    bool flush()
+    {
+        size_t sent = 0;
+        while (sent < wbuf.size())
+        {
+            ssize_t n = ::send(sock, wbuf.data() + sent, wbuf.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+            {
+                wbuf.clear();
+                return false;
+            }
+            sent += n;
+        }
+        wbuf.clear();
+        return true;
+    }
+
+    bool sendframe(uint8_t type, const string &payload)
+    {
+        queue(type, payload);
+        return flush();
+    }
+
+    // blocking until one whole frame is available, false on close or error
+    bool recvframe(uint8_t &type, string &payload)
+    {
+        while (true)
+        {
+            framestatus st = nextframe(rbuf, roff, type, payload);
+            if (st == FRAME_OK)
+            {
+                if (roff == rbuf.size()) // everything consumed
+                {
+                    rbuf.clear();
+                    roff = 0;
+                }
+                return true;
+            }
+            if (st == FRAME_TOOBIG) return false;
+
+            // compacting before growing
+            if (roff > 0)
+            {
+                rbuf.erase(0, roff);
+                roff = 0;
+            }
+            size_t have = rbuf.size();
+            rbuf.resize(have + READ_CHUNK);
+            ssize_t n = ::read(sock, &rbuf[have], READ_CHUNK);
+            if (n < 0 && errno == EINTR)
+            {
+                rbuf.resize(have);
+                continue;
+            }
+            if (n <= 0)
+            {
+                rbuf.resize(have);
+                return false;
+            }
+            rbuf.resize(have + n);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef SHARDMAP_H
+#define SHARDMAP_H
+
+// tracker shards and which one owns a group
+// tracker_info.txt has one "<ip> <port> [shard]" line per tracker. trackers
+// with the same shard number (1 when left out) are one replicated set, a
+// primary and its standbys, and each shard holds its own groups
+//
+// a group belongs to the shard found on a consistent hash ring: every shard
+// puts SHARD_POINTS points on the ring and owns the group ids hashing at or
+// before each of them, so adding a shard takes about 1/n of the groups and
+// leaves the rest where they were. trackers and clients build the ring from
+// the same shard numbers with the same hash, so they agree on every owner
+// without asking each other
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+const int SHARD_POINTS = 64; // ring points per shard
+
+// one tracker_info.txt line
+struct trackeraddr
+{
+    string ip;
+    string port;
+    int shard = 1;
+};
+
+// reading every tracker line of path, empty if it cannot be read
+inline vector<trackeraddr> readtrackerinfo(const char *path)
+{
+    vector<trackeraddr> addrs;
+    FILE *file = fopen(path, "r");
+    if (!file) return addrs;
+    char line[256], ipbuf[128], portbuf[32];
+    while (fgets(line, sizeof(line), file))
+    {
+        int shard = 1;
+        int n = sscanf(line, "%127s %31s %d", ipbuf, portbuf, &shard);
+        if (n < 2) continue; // blank line
+        addrs.push_back({ipbuf, portbuf, n == 3 && shard > 0 ? shard : 1});
+    }
+    fclose(file);
+    return addrs;
+}
+
+// FNV-1a with a final mix, fixed so that every build places names alike
+inline uint64_t shardhash(string_view s)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : s)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+class shardring
+{
+    vector<pair<uint64_t, int>> points; // ring position to shard number, sorted
+    vector<int> numbers;                // distinct shard numbers, sorted
+
+public:
+    // placing every shard number found in addrs on the ring
+    void build(const vector<trackeraddr> &addrs)
+    {
+        points.clear();
+        numbers.clear();
+        for (auto &a : addrs) numbers.push_back(a.shard);
+        sort(numbers.begin(), numbers.end());
+        numbers.erase(unique(numbers.begin(), numbers.end()), numbers.end());
+        for (int s : numbers)
+        {
+            for (int p = 0; p < SHARD_POINTS; p++)
+            {
+                points.emplace_back(shardhash("shard " + to_string(s) + " " + to_string(p)), s);
+            }
+        }
+        sort(points.begin(), points.end());
+    }
+
+    const vector<int> &shards() const { return numbers; }
+
+    size_t size() const { return numbers.size(); }
+
+    // shard owning group name, also the home shard of a user of that name
+    int owner(string_view name) const
+    {
+        if (numbers.size() < 2) return numbers.empty() ? 1 : numbers[0];
+        uint64_t h = shardhash(name);
+        auto it = lower_bound(points.begin(), points.end(), make_pair(h, 0));
+        if (it == points.end()) it = points.begin(); // wrapping around
+        return it->second;
+    }
+};
+
+#endif
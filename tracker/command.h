@@ -0,0 +1,76 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+// command parsing and reply building without heap allocations
+// tokens are views into the received frame, numbers are parsed straight off
+// them and replies are appended part by part into a buffer that keeps its
+// capacity between commands
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <type_traits>
+
+using namespace std;
+
+// splitting a command line on spaces, runs of spaces make no empty tokens
+// out is reused by the caller so its storage survives between commands
+inline void tokenize(string_view line, vector<string_view> &out)
+{
+    out.clear();
+    size_t i = 0;
+    while (i < line.size())
+    {
+        while (i < line.size() && line[i] == ' ') i++; // skipping spaces
+        size_t start = i;
+        while (i < line.size() && line[i] != ' ') i++; // token
+        if (i > start) out.push_back(line.substr(start, i - start));
+    }
+}
+
+// leading integer of a token like atoll, 0 if it has none
+inline long long tonum(string_view s)
+{
+    long long v = 0;
+    const char *b = s.data(), *e = s.data() + s.size();
+    if (b != e && *b == '+') b++;
+    from_chars(b, e, v);
+    return v;
+}
+
+inline uint64_t tounum(string_view s)
+{
+    uint64_t v = 0;
+    from_chars(s.data(), s.data() + s.size(), v);
+    return v;
+}
+
+// appending one reply part: text, a character or a number in decimal
+inline void putpart(string &out, string_view s)
+{
+    out.append(s.data(), s.size());
+}
+
+inline void putpart(string &out, char c)
+{
+    out.push_back(c);
+}
+
+template <typename T, typename enable_if<is_integral<T>::value && !is_same<T, char>::value && !is_same<T, bool>::value, int>::type = 0>
+inline void putpart(string &out, T v)
+{
+    char buf[24];
+    auto res = to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr - buf);
+}
+
+// appending parts in order, put(out, "SIZE ", size, "\n")
+template <typename... P>
+inline void put(string &out, const P &... parts)
+{
+    (putpart(out, parts), ...);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+// subscriptions and pushed events
+// a connection subscribes to a file's content (its seeders coming online or
+// going away) or to a group (files uploaded to it). the command that changes
+// either sends the event as a FRAME_EVENT on every subscribed connection, so
+// clients learn about it without polling
+//
+// the thread that raises an event writes it straight to the subscriber's
+// socket without blocking. bytes the socket does not take wait in the
+// connection's queue and go out with its next reply (clients heartbeat every
+// few seconds). a queue over MAX_PUSH_BYTES drops events and later tells the
+// subscriber how many it missed, so a stuck client costs bounded memory
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <algorithm>
+#include <errno.h>
+#include <sys/socket.h>
+#include "../common/frame.h"
+#include "command.h"
+
+using namespace std;
+
+enum topickind : uint64_t
+{
+    TOPIC_FILE = 1,     // content id, seeders online / offline
+    TOPIC_GROUP = 2,    // group id, files uploaded
+};
+
+inline uint64_t topicof(topickind kind, uint32_t id)
+{
+    return (kind << 32) | id;
+}
+
+const size_t MAX_PUSH_BYTES = 1024 * 1024;  // event bytes waiting per connection
+const size_t MAX_SUBSCRIPTIONS = 256;       // topics per connection
+
+// events of one connection on their way out, shared by the worker serving
+// the connection and any thread raising an event
+struct pushqueue
+{
+    mutex mtx;              // guards the fields below and writes to the socket
+    int fd = -1;            // socket
+    string buf;             // event frames not written yet
+    size_t off = 0;         // bytes of buf already written
+    bool replying = false;  // a reply is partly written, events wait behind it
+    uint64_t missed = 0;    // events dropped since the queue was last full
+    vector<uint64_t> topics; // subscribed topics, guarded by the hub
+
+    // writing queued events as far as the socket takes them, caller holds mtx
+    // returns bytes written, -1 on error
+    ssize_t writeout()
+    {
+        ssize_t total = 0;
+        while (off < buf.size())
+        {
+            ssize_t n = ::send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0)
+            {
+                off += n;
+                total += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break; // socket full
+            return -1;
+        }
+        if (off == buf.size())
+        {
+            buf.clear();
+            off = 0;
+        }
+        else if (off > buf.size() / 2)
+        {
+            buf.erase(0, off); // keeping what waits small
+            off = 0;
+        }
+        return total;
+    }
+};
+
+class eventhub
+{
+    shared_mutex mtx;   // guards subs and every queue's topics
+    unordered_map<uint64_t, vector<pushqueue *>> subs; // topic to subscribers
+    atomic<size_t> count{0};    // subscriptions, 0 skips publishing entirely
+
+    // queueing one encoded event on q and writing it if no reply is in the way
+    void deliver(pushqueue *q, const string &frame)
+    {
+        lock_guard<mutex> lock(q->mtx);
+        if (q->buf.size() - q->off + frame.size() > MAX_PUSH_BYTES)
+        {
+            q->missed++;
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        if (q->missed)
+        {
+            size_t at = beginframe(q->buf, FRAME_EVENT);
+            put(q->buf, "EVENTS_MISSED ", q->missed);
+            endframe(q->buf, at);
+            q->missed = 0;
+        }
+        q->buf += frame;
+        pushed.fetch_add(1, memory_order_relaxed);
+        if (!q->replying) q->writeout(); // errors surface on the connection's own next read
+    }
+
+public:
+    atomic<uint64_t> pushed{0}, dropped{0}; // events queued, events over the limit
+
+    size_t subscriptions() const { return count.load(memory_order_relaxed); }
+
+    // false if q already has MAX_SUBSCRIPTIONS topics
+    bool subscribe(pushqueue *q, uint64_t t)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        if (find(q->topics.begin(), q->topics.end(), t) != q->topics.end()) return true;
+        if (q->topics.size() >= MAX_SUBSCRIPTIONS) return false;
+        q->topics.push_back(t);
+        subs[t].push_back(q);
+        count.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // false if q was not subscribed to t
+    bool unsubscribe(pushqueue *q, uint64_t t)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = find(q->topics.begin(), q->topics.end(), t);
+        if (it == q->topics.end()) return false;
+        q->topics.erase(it);
+        auto s = subs.find(t);
+        s->second.erase(find(s->second.begin(), s->second.end(), q));
+        if (s->second.empty()) subs.erase(s);
+        count.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+    // forgetting every subscription of a closing connection, once this
+    // returns no publisher touches q any more
+    void drop(pushqueue *q)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        for (uint64_t t : q->topics)
+        {
+            auto s = subs.find(t);
+            s->second.erase(find(s->second.begin(), s->second.end(), q));
+            if (s->second.empty()) subs.erase(s);
+            count.fetch_sub(1, memory_order_relaxed);
+        }
+        q->topics.clear();
+    }
+
+    // ending every subscription to t, whose group or content was reclaimed,
+    // before its id can stand for another one
+    void droptopic(uint64_t t)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        auto s = subs.find(t);
+        if (s == subs.end()) return;
+        for (pushqueue *q : s->second) q->topics.erase(find(q->topics.begin(), q->topics.end(), t));
+        count.fetch_sub(s->second.size(), memory_order_relaxed);
+        subs.erase(s);
+    }
+
+    // sending an event made of parts (text, numbers) to every subscriber of t
+    template <typename... P>
+    void publish(uint64_t t, const P &... parts)
+    {
+        if (subscriptions() == 0) return;
+        static thread_local string frame; // encoded once for every subscriber
+        frame.clear();
+        size_t at = beginframe(frame, FRAME_EVENT);
+        put(frame, parts...);
+        endframe(frame, at);
+
+        shared_lock<shared_mutex> lock(mtx);
+        auto it = subs.find(t);
+        if (it == subs.end()) return;
+        for (pushqueue *q : it->second) deliver(q, frame);
+    }
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+// asynchronous leveled logger for the tracker
+// every thread that logs owns a ring of fixed size lines and is its only
+// writer, a background thread drains all rings to stdout in batches, so a
+// handler pays for formatting one line and a copy, never for a write or a
+// flush, and never waits on another thread. a full ring drops the line
+// (counted and reported) rather than blocking
+//
+// per-command lines can be sampled (1 in N) and rate limited per thread,
+// lines left out that way are counted and reported too
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "command.h"
+
+using namespace std;
+
+enum loglevel
+{
+    LOG_ERROR = 0,  // something failed
+    LOG_WARN = 1,   // unusual but handled (lease expiry, resync, ...)
+    LOG_INFO = 2,   // state changes and per-command lines
+    LOG_DEBUG = 3,  // everything
+};
+
+const size_t LOG_RING = 1024;       // lines per thread ring
+const size_t LOG_LINE = 240;        // longer lines are cut
+const int LOG_DRAIN_MS = 10;        // drain pause when rings are empty
+const int64_t LOG_REPORT_NS = 1000000000; // dropped / skipped counts reported at most this often
+
+// one line waiting in a ring
+struct logentry
+{
+    int64_t when;           // steady clock ns, orders lines across threads
+    uint16_t len;           // bytes of text used
+    char text[LOG_LINE];
+};
+
+// lines of one thread, single producer (the owner) and single consumer (drain)
+struct logring
+{
+    logentry lines[LOG_RING];
+    atomic<uint64_t> head{0};       // next line written, owner only
+    atomic<uint64_t> tail{0};       // next line drained, drain only
+    atomic<uint64_t> dropped{0};    // lines lost to a full ring, owner only
+    atomic<uint64_t> skipped{0};    // command lines sampled or rate limited away, owner only
+    uint64_t droppedseen = 0, skippedseen = 0; // counts already reported, drain only
+    atomic<bool> owned{false};      // a live thread writes here
+
+    // command line sampling and rate limit state, owner only
+    uint64_t seen = 0;              // command lines offered
+    double tokens = 0;              // rate limit bucket
+    int64_t refilled = 0;           // last refill, steady clock ns
+};
+
+class asynclog
+{
+    mutex mtx;                      // guards rings list and draining
+    vector<logring *> rings;        // every ring, reused after its thread exits
+    atomic<bool> started{false};
+    vector<pair<int64_t, string_view>> batch;   // drain: time, line
+    vector<pair<logring *, uint64_t>> taken;    // drain: ring, new tail
+    string out;                                 // drain: one write per batch
+    int64_t reported = 0;                       // drain: last dropped / skipped report
+
+    static int64_t now()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // ring of the calling thread, handed back when the thread exits
+    logring &mine()
+    {
+        struct owner
+        {
+            logring *ring = nullptr;
+            ~owner() { if (ring) ring->owned.store(false, memory_order_release); }
+        };
+        static thread_local owner me;
+        if (!me.ring)
+        {
+            lock_guard<mutex> lock(mtx);
+            for (logring *r : rings)
+            {
+                if (!r->owned.load(memory_order_acquire))
+                {
+                    me.ring = r;
+                    break;
+                }
+            }
+            if (!me.ring)
+            {
+                me.ring = new logring();
+                rings.push_back(me.ring);
+            }
+            me.ring->owned.store(true, memory_order_relaxed);
+        }
+        return *me.ring;
+    }
+
+    // copying a formatted line into the ring, false if it is full
+    bool push(logring &r, const string &line)
+    {
+        uint64_t h = r.head.load(memory_order_relaxed);
+        if (h - r.tail.load(memory_order_acquire) >= LOG_RING)
+        {
+            r.dropped.store(r.dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return false;
+        }
+        logentry &e = r.lines[h % LOG_RING];
+        e.when = now();
+        e.len = (uint16_t)min(line.size(), LOG_LINE);
+        memcpy(e.text, line.data(), e.len);
+        if (line.size() > LOG_LINE) memcpy(e.text + LOG_LINE - 3, "...", 3);
+        r.head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    // line buffer reused by every line a thread formats
+    static string &scratch()
+    {
+        static thread_local string line;
+        line.clear();
+        return line;
+    }
+
+public:
+    atomic<int> level{LOG_INFO};        // lines above this are not formatted at all
+    atomic<int> commandsample{1};       // 1 in this many command lines is kept
+    atomic<int> commandrate{1000};      // command lines per second per thread, 0 for no limit
+
+    bool enabled(loglevel lv) const { return lv <= level.load(memory_order_relaxed); }
+
+    // queueing a line made of parts (text, numbers)
+    template <typename... P>
+    void line(loglevel lv, const P &... parts)
+    {
+        if (!enabled(lv)) return;
+        string &l = scratch();
+        put(l, parts...);
+        push(mine(), l);
+    }
+
+    // queueing a per-command line, subject to sampling and the rate limit
+    template <typename... P>
+    void command(const P &... parts)
+    {
+        if (!enabled(LOG_INFO)) return;
+        logring &r = mine();
+        int sample = commandsample.load(memory_order_relaxed);
+        if (sample > 1 && r.seen++ % sample != 0)
+        {
+            r.skipped.store(r.skipped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+        int rate = commandrate.load(memory_order_relaxed);
+        if (rate > 0)
+        {
+            int64_t t = now();
+            r.tokens = min((double)rate, r.tokens + (t - r.refilled) * 1e-9 * rate); // refill, burst of one second
+            r.refilled = t;
+            if (r.tokens < 1)
+            {
+                r.skipped.store(r.skipped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+                return;
+            }
+            r.tokens -= 1;
+        }
+        string &l = scratch();
+        put(l, parts...);
+        push(r, l);
+    }
+
+    // writing out every queued line, oldest first, and at most once a second
+    // how many were left out. returns lines written
+    size_t drain()
+    {
+        lock_guard<mutex> lock(mtx);
+        batch.clear();
+        taken.clear();
+        out.clear();
+        int64_t t0 = now();
+        bool report = t0 - reported >= LOG_REPORT_NS;
+        if (report) reported = t0;
+        uint64_t dropped = 0, skipped = 0;
+        for (logring *r : rings)
+        {
+            uint64_t t = r->tail.load(memory_order_relaxed), h = r->head.load(memory_order_acquire);
+            for (uint64_t i = t; i < h; i++)
+            {
+                logentry &e = r->lines[i % LOG_RING];
+                batch.emplace_back(e.when, string_view(e.text, e.len));
+            }
+            if (h != t) taken.emplace_back(r, h);
+            if (!report) continue;
+            uint64_t d = r->dropped.load(memory_order_relaxed), k = r->skipped.load(memory_order_relaxed);
+            dropped += d - r->droppedseen;
+            skipped += k - r->skippedseen;
+            r->droppedseen = d;
+            r->skippedseen = k;
+        }
+        stable_sort(batch.begin(), batch.end(), [](const pair<int64_t, string_view> &a, const pair<int64_t, string_view> &b) { return a.first < b.first; });
+
+        for (auto &b : batch)
+        {
+            out.append(b.second.data(), b.second.size());
+            out += '\n';
+        }
+        if (dropped) put(out, "------- Log rings full, ", dropped, " lines dropped -------\n");
+        if (skipped) put(out, "------- ", skipped, " command lines not logged (sampling / rate limit) -------\n");
+        if (!out.empty())
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+        }
+        for (auto &t : taken) t.first->tail.store(t.second, memory_order_release); // slots free again
+        return batch.size();
+    }
+
+    // starting the drain thread, lines queued before this wait for it
+    void start()
+    {
+        if (started.exchange(true)) return;
+        thread([this]()
+        {
+            while (true)
+            {
+                if (drain() == 0) this_thread::sleep_for(chrono::milliseconds(LOG_DRAIN_MS));
+            }
+        }).detach();
+    }
+};
+
+#endif
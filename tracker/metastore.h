@@ -0,0 +1,941 @@
+#ifndef METASTORE_H
+#define METASTORE_H
+
+// sharded metadata store for the tracker
+// users, groups (with their file lists) and files are each split into shards
+// by hash of their key, every shard has its own reader-writer lock so read
+// heavy commands (list_files, download_file) from different workers run in
+// parallel and only contend with writers touching the same shard
+//
+// lock order when nesting accessors: group -> file -> user
+// (never take a group or file shard from inside a user accessor)
+//
+// entries are keyed by interned name ids (see nametable), member and file
+// lists are sorted id vectors. users and groups are held through unique_ptr,
+// so an entry is freed when the map drops it
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <stdint.h>
+#include <string.h>
+#include "../common/digest.h"
+
+using namespace std;
+
+typedef uint32_t nameid;             // interned user, group or file name
+const nameid NOID = UINT32_MAX;     // name never seen
+
+// bytes kept as long as the table that took them: name text and index
+// nodes. names live long, so they are bump allocated in blocks of their own
+// and never pin heap pages that reclaimed groups and files freed. pieces
+// given back go on a free list per size and are taken again first, the
+// blocks themselves stay
+class namearena
+{
+    static constexpr size_t BLOCK = 64 * 1024;
+    vector<char *> blocks;
+    size_t used = BLOCK;    // bytes taken from the last block
+    unordered_map<size_t, void *> freed; // size to given back pieces, linked through their first word
+
+    // every piece is a multiple of 8 bytes and 8-aligned, room for the link
+    static size_t rounded(size_t n) { return n < 8 ? 8 : (n + 7) & ~(size_t)7; }
+
+public:
+    size_t held = 0;        // bytes in blocks
+    size_t spare = 0;       // bytes on the free lists
+
+    ~namearena()
+    {
+        for (char *b : blocks) delete[] b;
+    }
+
+    void *take(size_t n)
+    {
+        n = rounded(n);
+        auto it = freed.find(n);
+        if (it != freed.end())
+        {
+            void *p = it->second;
+            void *next = *(void **)p;
+            if (next) it->second = next;
+            else freed.erase(it);
+            spare -= n;
+            return p;
+        }
+        if (used + n > BLOCK)
+        {
+            blocks.push_back(new char[max(n, BLOCK)]); // aligned for anything
+            held += max(n, BLOCK);
+            used = 0;
+        }
+        void *p = blocks.back() + used;
+        used += n;
+        return p;
+    }
+
+    // piece of n bytes from take, free for the next take of that size
+    void give(void *p, size_t n)
+    {
+        n = rounded(n);
+        void *&head = freed[n];
+        *(void **)p = head;
+        head = p;
+        spare += n;
+    }
+};
+
+// allocator putting single nodes in an arena (given back to it when freed)
+// and arrays (hash buckets, replaced on rehash) on the heap
+template <typename T>
+struct arenaalloc
+{
+    typedef T value_type;
+    namearena *arena;
+
+    arenaalloc(namearena *a) : arena(a) {}
+    template <typename U>
+    arenaalloc(const arenaalloc<U> &o) : arena(o.arena) {}
+
+    T *allocate(size_t n)
+    {
+        static_assert(alignof(T) <= 8, "arena pieces are 8-aligned");
+        if (n == 1) return (T *)arena->take(sizeof(T));
+        return (T *)::operator new(n * sizeof(T));
+    }
+    void deallocate(T *p, size_t n)
+    {
+        if (n == 1) arena->give(p, sizeof(T));
+        else ::operator delete(p);
+    }
+    template <typename U>
+    bool operator==(const arenaalloc<U> &o) const { return arena == o.arena; }
+    template <typename U>
+    bool operator!=(const arenaalloc<U> &o) const { return arena != o.arena; }
+};
+
+// interned names: every user, group and file name is stored once and given a
+// dense id, the maps and member lists below hold ids only. a command looks its
+// names up once and works with ids from there on. a name nobody refers to any
+// more (a reclaimed group or content) is released, and its id and text are
+// handed out again only after the next compact but one, a whole reaper sweep
+// later. so an id a command looked up stays valid while the command runs, and
+// its name can be read without a lock
+class nametable
+{
+    static const size_t CHUNK = 4096;           // names per chunk
+    static const size_t MAX_CHUNKS = 1 << 14;   // up to 2^26 names
+    typedef unordered_map<string_view, nameid, hash<string_view>, equal_to<string_view>, arenaalloc<pair<const string_view, nameid>>> index;
+    mutable shared_mutex mtx;                   // guards arena, ids, count and the id lists
+    namearena arena;                            // name text and index nodes
+    index ids;                                  // keys point into the arena
+    atomic<string_view *> chunks[MAX_CHUNKS];   // names by id, chunks never move
+    nameid count = 0;                           // ids handed out so far
+    vector<nameid> released;                    // released since the last compact
+    vector<nameid> cooling;                     // released before it, reusable after the next
+    vector<nameid> reusable;                    // handed out again before new ids
+
+public:
+    nametable() : ids(0, hash<string_view>(), equal_to<string_view>(), arenaalloc<pair<const string_view, nameid>>(&arena))
+    {
+        for (auto &c : chunks) c.store(nullptr, memory_order_relaxed);
+    }
+    ~nametable()
+    {
+        for (auto &c : chunks) delete[] c.load(memory_order_relaxed);
+    }
+
+    // id of name, NOID if it was never interned
+    nameid find(string_view name) const
+    {
+        shared_lock<shared_mutex> lock(mtx);
+        auto it = ids.find(name);
+        return it == ids.end() ? NOID : it->second;
+    }
+
+    // id of name, giving it the next one if new
+    nameid intern(string_view name)
+    {
+        nameid id = find(name);
+        if (id != NOID) return id;
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        if (!reusable.empty())
+        {
+            id = reusable.back();
+            reusable.pop_back();
+        }
+        else
+        {
+            if (count == CHUNK * MAX_CHUNKS)
+            {
+                cerr << "------- Name table full -------" << endl;
+                abort();
+            }
+            id = count++;
+        }
+        string_view *chunk = chunks[id / CHUNK].load(memory_order_relaxed);
+        if (!chunk)
+        {
+            chunk = new string_view[CHUNK];
+            chunks[id / CHUNK].store(chunk, memory_order_release);
+        }
+        char *text = (char *)arena.take(name.size());
+        memcpy(text, name.data(), name.size());
+        chunk[id % CHUNK] = string_view(text, name.size());
+        ids.emplace(chunk[id % CHUNK], id);
+        return id;
+    }
+
+    // forgetting a name nothing refers to any more, find no longer knows it
+    void release(nameid id)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = ids.find(name(id));
+        if (it == ids.end() || it->second != id) return; // released already
+        ids.erase(it);
+        released.push_back(id);
+    }
+
+    // handing the ids and text released before the previous compact back
+    // for reuse, returns how many
+    size_t compact()
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        for (nameid id : cooling)
+        {
+            string_view text = name(id);
+            arena.give((void *)text.data(), text.size());
+            reusable.push_back(id);
+        }
+        size_t done = cooling.size();
+        cooling.swap(released);
+        released.clear();
+        return done;
+    }
+
+    // name of an id handed out by find or intern
+    string_view name(nameid id) const
+    {
+        return chunks[id / CHUNK].load(memory_order_acquire)[id % CHUNK];
+    }
+
+    // names interned and not released
+    size_t size() const
+    {
+        shared_lock<shared_mutex> lock(mtx);
+        return ids.size();
+    }
+
+    // bytes behind the names: chunks, arena blocks in use and hash buckets
+    size_t bytes() const
+    {
+        shared_lock<shared_mutex> lock(mtx);
+        size_t total = ((count + CHUNK - 1) / CHUNK) * CHUNK * sizeof(string_view);
+        return total + arena.held - arena.spare + ids.bucket_count() * sizeof(void *);
+    }
+};
+
+// set of ids as a sorted vector, 4 bytes a member and no hash nodes
+struct idset
+{
+    vector<nameid> ids;
+
+    // false if already there
+    bool insert(nameid id)
+    {
+        auto it = lower_bound(ids.begin(), ids.end(), id);
+        if (it != ids.end() && *it == id) return false;
+        ids.insert(it, id);
+        return true;
+    }
+
+    // false if it was not there
+    bool erase(nameid id)
+    {
+        auto it = lower_bound(ids.begin(), ids.end(), id);
+        if (it == ids.end() || *it != id) return false;
+        ids.erase(it);
+        return true;
+    }
+
+    bool contains(nameid id) const { return binary_search(ids.begin(), ids.end(), id); }
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    void clear() { ids.clear(); }
+
+    // giving back room left over from members that have gone, true if it did
+    bool compact()
+    {
+        if (ids.capacity() <= 2 * ids.size() + 8) return false;
+        ids.shrink_to_fit();
+        return true;
+    }
+    vector<nameid>::const_iterator begin() const { return ids.begin(); }
+    vector<nameid>::const_iterator end() const { return ids.end(); }
+};
+
+// representing peer/client in the P2P network
+struct client
+{
+    string hostip, hostport, passcode;  // info for peer
+    idset files;                        // contents it seeds
+    idset partialfiles;                 // contents it has announced some pieces of
+    idset owned, joined;                // groups it is master of, member of (kept up with the groups, not stored)
+    bool connected = false;     // checking for connected
+    uint64_t session = 0;       // log seq of the login that started this session
+    atomic<long long> leaseuntil{0}; // seeder lease end (steady clock ms), renewed by heartbeat
+    atomic<int> uploads{0};          // pieces it is serving right now, from heartbeat
+    atomic<float> goodrate{1.0f};    // decayed share of good pieces downloaders report getting from it
+
+    client(const string& code)
+        : passcode(code), connected(false) {} // constructor
+
+    void login(string_view ip, string_view port)
+    {
+        hostip = ip;        // setting ip
+        hostport = port;    // setting port
+        connected = true;   // setting connected
+    }
+
+    void logout()
+    {
+        connected = false;  // setting not connected
+        hostip.clear();     // clearing ip
+        hostport.clear();   // clearing port
+    }
+};
+
+// representing a group in the P2P network
+class group
+{
+public:
+    nameid groupmaster = NOID;      // group master
+    idset participants, applicants; // members and requests
+
+    group(nameid owner)
+    {
+        groupmaster = owner; // setting master
+        participants.insert(owner); // adding master to group
+    }
+
+    // checking applicant
+    bool isapplicant(nameid s) const
+    {
+        return applicants.contains(s);
+    }
+
+    // checking if member of a group
+    bool partofgroup(nameid s) const
+    {
+        return participants.contains(s);
+    }
+
+    // removing member, true if it was the master and the group changed hands
+    bool deluser(nameid s, const nametable &usernames)
+    {
+        participants.erase(s);  // removing user
+        if (s != groupmaster) return false;
+        groupmaster = NOID;     // no master
+        for (nameid u : participants)
+        {
+            // smallest name, so replaying the log picks the same owner
+            if (groupmaster == NOID || usernames.name(u) < usernames.name(groupmaster)) groupmaster = u; // new master
+        }
+        return true;
+    }
+
+    void acceptreq(nameid s)
+    {
+        applicants.erase(s); // removing request
+        participants.insert(s); // adding to  group
+    }
+
+};
+
+// online seeder of a file with the address handed to downloaders
+struct seederaddr
+{
+    client *peer = nullptr; // for the lease check
+    string ip, port;        // address at login
+};
+
+// downloader that already holds some pieces of a file and serves them
+struct partialseeder
+{
+    seederaddr addr;        // where it can be reached
+    vector<uint8_t> bits;   // piece i is bit (0x80 >> i % 8) of byte i / 8
+    int have = 0;           // pieces set
+
+    // marking piece held, false if it already was
+    bool setpiece(int i)
+    {
+        uint8_t mask = 0x80 >> (i % 8);
+        if (bits[i / 8] & mask) return false;
+        bits[i / 8] |= mask;
+        have++;
+        return true;
+    }
+};
+
+// metadata for shared content : size, hashes, seeders
+// keyed by full file hash, so every group and file name holding the same
+// bytes shares one piece hash list and one seeder pool
+struct FileMeta
+{
+    long long size = 0;     // size of file
+    string fullhash;        // hashing of full file
+    int num_pieces = 0;     // pieces
+    vector<sha1digest> piece_hashes; // piece hashes, 20 bytes each, contiguous
+    idset peers;            // who has file
+    unordered_map<nameid, seederaddr> online; // peers logged in right now, kept up by login/logout
+    unordered_map<nameid, partialseeder> partial; // logged in downloaders with some pieces, from have_pieces
+    vector<pair<nameid, nameid>> listed; // group and file name pairs standing for this content, not stored
+
+    void unlist(nameid g, nameid fname)
+    {
+        listed.erase(remove(listed.begin(), listed.end(), make_pair(g, fname)), listed.end());
+    }
+
+    // nothing left to hand out: no full or partial seeder, or no group lists it
+    bool idle() const
+    {
+        return (peers.empty() && partial.empty()) || listed.empty();
+    }
+};
+
+const size_t NUM_SHARDS = 64; // shards per map
+
+// hash table with far more buckets than entries, worth rehashing
+template <typename M>
+bool sparse(const M &m)
+{
+    return m.bucket_count() > 64 && m.bucket_count() > 4 * m.size();
+}
+
+// one slice of a map with its own lock
+template <typename T>
+struct shard
+{
+    shared_mutex mtx;               // readers share, writers exclusive
+    unordered_map<nameid, T> items; // entries whose id falls in this shard
+};
+
+// group state that is always read and written together
+struct groupentry
+{
+    unique_ptr<group> grp;                  // group
+    unordered_map<nameid, nameid> files;    // file name uploaded to group to its content
+    map<string_view, nameid> byname;        // same names in order for paged listing, views into the name table
+
+    // file name fname (id of name in names) now stands for content, returns
+    // the content it stood for before, NOID if it is new here
+    nameid addfile(nameid fname, nameid content, const nametable &names)
+    {
+        auto it = files.find(fname);
+        if (it == files.end())
+        {
+            files.emplace(fname, content);
+            byname.emplace(names.name(fname), fname);
+            return NOID;
+        }
+        nameid old = it->second;
+        it->second = content;
+        return old;
+    }
+
+    void removefile(nameid fname, const nametable &names)
+    {
+        if (files.erase(fname)) byname.erase(names.name(fname));
+    }
+
+    // content behind a file name, NOID if not uploaded here
+    nameid contentof(nameid fname) const
+    {
+        auto it = files.find(fname);
+        return it == files.end() ? NOID : it->second;
+    }
+};
+
+// entries held through unique_ptr are handed to accessors as plain pointers,
+// the map keeps ownership
+template <typename T>
+T &entryof(T &v) { return v; }
+template <typename T>
+T *entryof(unique_ptr<T> &v) { return v.get(); }
+
+template <typename T>
+class shardedmap
+{
+    shard<T> shards[NUM_SHARDS];
+    atomic<size_t> count{0};    // entries, kept by every insert and erase so size() takes no lock
+
+public:
+    // ids are dense, so consecutive ones land in different shards
+    shard<T> &shardof(nameid key)
+    {
+        return shards[key % NUM_SHARDS];
+    }
+
+    // calling fn on entry under shared lock, false if missing
+    template <typename F>
+    bool read(nameid key, F fn)
+    {
+        shard<T> &sh = shardof(key);
+        shared_lock<shared_mutex> lock(sh.mtx);
+        auto it = sh.items.find(key);
+        if (it == sh.items.end()) return false;
+        fn(entryof(it->second));
+        return true;
+    }
+
+    // calling fn on entry under exclusive lock, false if missing
+    template <typename F>
+    bool write(nameid key, F fn)
+    {
+        shard<T> &sh = shardof(key);
+        unique_lock<shared_mutex> lock(sh.mtx);
+        auto it = sh.items.find(key);
+        if (it == sh.items.end()) return false;
+        fn(entryof(it->second));
+        return true;
+    }
+
+    // calling fn on entry under exclusive lock, creating it when missing
+    template <typename F>
+    void upsert(nameid key, F fn)
+    {
+        shard<T> &sh = shardof(key);
+        unique_lock<shared_mutex> lock(sh.mtx);
+        auto ins = sh.items.try_emplace(key);
+        if (ins.second) count.fetch_add(1, memory_order_relaxed);
+        fn(entryof(ins.first->second));
+    }
+
+    // inserting value if key is free, false if already taken (val is dropped then)
+    bool insert(nameid key, T val)
+    {
+        shard<T> &sh = shardof(key);
+        unique_lock<shared_mutex> lock(sh.mtx);
+        if (!sh.items.try_emplace(key, move(val)).second) return false;
+        count.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    // dropping entry and what it owns, false if missing
+    bool erase(nameid key)
+    {
+        shard<T> &sh = shardof(key);
+        unique_lock<shared_mutex> lock(sh.mtx);
+        if (sh.items.erase(key) == 0) return false;
+        count.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+    bool contains(nameid key)
+    {
+        shard<T> &sh = shardof(key);
+        shared_lock<shared_mutex> lock(sh.mtx);
+        return sh.items.find(key) != sh.items.end();
+    }
+
+    // visiting every entry, one shard locked at a time
+    template <typename F>
+    void readall(F fn)
+    {
+        for (size_t i = 0; i < NUM_SHARDS; i++)
+        {
+            shared_lock<shared_mutex> lock(shards[i].mtx);
+            for (auto &it : shards[i].items) fn(it.first, entryof(it.second));
+        }
+    }
+
+    template <typename F>
+    void writeall(F fn)
+    {
+        for (size_t i = 0; i < NUM_SHARDS; i++)
+        {
+            unique_lock<shared_mutex> lock(shards[i].mtx);
+            for (auto &it : shards[i].items) fn(it.first, entryof(it.second));
+        }
+    }
+
+    // dropping every entry
+    void clear()
+    {
+        for (size_t i = 0; i < NUM_SHARDS; i++)
+        {
+            unique_lock<shared_mutex> lock(shards[i].mtx);
+            count.fetch_sub(shards[i].items.size(), memory_order_relaxed);
+            shards[i].items.clear();
+        }
+    }
+
+    // shard by shard, shrinking hash tables left sparse by erased entries and
+    // calling fn on every entry to shrink its own containers (fn returns true
+    // if it gave memory back). returns tables rehashed plus entries shrunk
+    template <typename F>
+    size_t compact(F fn)
+    {
+        size_t done = 0;
+        for (size_t i = 0; i < NUM_SHARDS; i++)
+        {
+            unique_lock<shared_mutex> lock(shards[i].mtx);
+            for (auto &it : shards[i].items) done += fn(entryof(it.second));
+            if (sparse(shards[i].items))
+            {
+                shards[i].items.rehash(0); // smallest table for what is left
+                done++;
+            }
+        }
+        return done;
+    }
+
+    size_t size() const { return count.load(memory_order_relaxed); }
+};
+
+// all tracker metadata
+// file name search across groups: every trigram of a lowercased file name
+// to the ids of the names holding it, and every name to the groups it is
+// uploaded to. a query intersects the posting lists of its own trigrams,
+// starting from the shortest, so it costs the rarest trigram, not the
+// number of files. one reader-writer lock, taken before any shard lock
+// and never inside one
+class searchindex
+{
+    mutable shared_mutex mtx;
+    unordered_map<uint32_t, idset> postings;        // trigram to file names
+    unordered_map<nameid, vector<nameid>> groupsof; // file name to groups listing it
+
+    static char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+    // distinct trigrams of name, case folded
+    static void trigrams(string_view name, vector<uint32_t> &out)
+    {
+        out.clear();
+        for (size_t i = 0; i + 3 <= name.size(); i++)
+        {
+            out.push_back((uint32_t)(uint8_t)lower(name[i]) << 16 | (uint32_t)(uint8_t)lower(name[i + 1]) << 8 | (uint8_t)lower(name[i + 2]));
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+    }
+
+public:
+    static constexpr size_t MIN_QUERY = 3; // shorter queries have no trigram
+
+    // name contains query, ignoring case
+    static bool contains(string_view name, string_view query)
+    {
+        for (size_t i = 0; i + query.size() <= name.size(); i++)
+        {
+            size_t j = 0;
+            while (j < query.size() && lower(name[i + j]) == lower(query[j])) j++;
+            if (j == query.size()) return true;
+        }
+        return false;
+    }
+
+    // file name fname (text name) is now listed in group g
+    void add(nameid fname, string_view name, nameid g)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        vector<nameid> &gs = groupsof[fname];
+        if (find(gs.begin(), gs.end(), g) != gs.end()) return;
+        gs.push_back(g);
+        if (gs.size() > 1) return; // trigrams already there
+        static thread_local vector<uint32_t> grams;
+        trigrams(name, grams);
+        for (uint32_t t : grams) postings[t].insert(fname);
+    }
+
+    // file name fname is no longer listed in group g, true if no group
+    // lists it any more
+    bool remove(nameid fname, string_view name, nameid g)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        auto it = groupsof.find(fname);
+        if (it == groupsof.end()) return false;
+        it->second.erase(std::remove(it->second.begin(), it->second.end(), g), it->second.end());
+        if (!it->second.empty()) return false;
+        groupsof.erase(it);
+        static thread_local vector<uint32_t> grams;
+        trigrams(name, grams);
+        for (uint32_t t : grams)
+        {
+            auto p = postings.find(t);
+            if (p == postings.end()) continue;
+            p->second.erase(fname);
+            if (p->second.empty()) postings.erase(p);
+        }
+        return true;
+    }
+
+    // calling fn(fname, groups) for names containing query (at least MIN_QUERY
+    // characters, any case) in name id order, starting after id after (NOID
+    // for the start), or at it with again (a page cut inside its groups).
+    // fn returns false to stop without taking the name. also stops once
+    // maxscan candidates were looked at. returns the last name taken or
+    // passed over then, for the next call to start after, or NOID if the
+    // matches ran out
+    template <typename F>
+    nameid match(string_view query, const nametable &names, nameid after, size_t maxscan, F fn, bool again = false) const
+    {
+        static thread_local vector<uint32_t> grams;
+        static thread_local vector<const idset *> lists;
+        static thread_local vector<size_t> pos; // per list, first id not below the candidate
+        trigrams(query, grams);
+        shared_lock<shared_mutex> lock(mtx);
+        lists.clear();
+        for (uint32_t t : grams)
+        {
+            auto p = postings.find(t);
+            if (p == postings.end()) return NOID; // a trigram no name has
+            lists.push_back(&p->second);
+        }
+        if (lists.empty()) return NOID;
+        sort(lists.begin(), lists.end(), [](const idset *a, const idset *b) { return a->size() < b->size(); });
+        pos.assign(lists.size(), 0);
+
+        // candidates only grow, so each list is walked forward by galloping
+        // from where the last candidate left it
+        auto inlist = [&](size_t i, nameid id)
+        {
+            const vector<nameid> &v = lists[i]->ids;
+            size_t lo = pos[i], step = 1;
+            while (lo + step < v.size() && v[lo + step] < id)
+            {
+                lo += step;
+                step *= 2;
+            }
+            pos[i] = lower_bound(v.begin() + lo, v.begin() + min(v.size(), lo + step + 1), id) - v.begin();
+            return pos[i] < v.size() && v[pos[i]] == id;
+        };
+
+        auto it = lists[0]->begin();
+        if (after != NOID) it = again ? lower_bound(it, lists[0]->end(), after) : upper_bound(it, lists[0]->end(), after);
+        size_t scanned = 0; // candidates looked at
+        nameid last = after; // last name done with
+        for (; it != lists[0]->end(); ++it)
+        {
+            nameid fname = *it;
+            bool all = true; // in every posting list
+            for (size_t i = 1; i < lists.size() && all; i++) all = inlist(i, fname);
+            if (!all) continue;
+            if (scanned++ == maxscan) return last;
+            if (contains(names.name(fname), query))
+            {
+                auto gs = groupsof.find(fname);
+                if (gs != groupsof.end() && !fn(fname, gs->second)) return last;
+            }
+            last = fname;
+        }
+        return NOID;
+    }
+
+    void clear()
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        postings.clear();
+        groupsof.clear();
+    }
+
+    size_t bytes(size_t node_bytes) const
+    {
+        shared_lock<shared_mutex> lock(mtx);
+        size_t total = (postings.size() + groupsof.size()) * node_bytes;
+        for (auto &p : postings) total += p.second.ids.capacity() * sizeof(nameid);
+        for (auto &g : groupsof) total += g.second.capacity() * sizeof(nameid);
+        return total;
+    }
+};
+
+struct metastore
+{
+    nametable usernames, groupnames, filenames; // names to ids and back
+    nametable contents;             // full file hashes, ids of distinct contents
+    shardedmap<unique_ptr<client>> peers; // user to client
+    shardedmap<groupentry> groups;  // group to group and its file names
+    shardedmap<FileMeta> files;     // content to meta
+    searchindex search;             // file names of every group, by trigram
+
+    // rebuilding derived state after a load: every seeder has the content in
+    // its file list, logged in seeders are in the file's online index, partial
+    // seeders are known to their user and carry its current address, every
+    // content knows the group file names standing for it, every user knows
+    // the groups it owns and is a member of, and the search index holds every
+    // group's file names
+    // (collects first, so no file shard is taken inside a user accessor)
+    void reindex()
+    {
+        vector<pair<nameid, nameid>> seeds, partials; // file, user
+        files.readall([&](nameid f, FileMeta &fm)
+        {
+            for (nameid u : fm.peers) seeds.emplace_back(f, u);
+            for (auto &it : fm.partial) partials.emplace_back(f, it.first);
+        });
+        vector<pair<nameid, pair<nameid, seederaddr>>> partialaddrs; // file, user, address (peer null if offline)
+        for (auto &fu : partials)
+        {
+            seederaddr addr;
+            peers.write(fu.second, [&](client *c)
+            {
+                if (!c->connected) return;
+                c->partialfiles.insert(fu.first);
+                addr = seederaddr{c, c->hostip, c->hostport};
+            });
+            partialaddrs.push_back({fu.first, {fu.second, addr}});
+        }
+        for (auto &p : partialaddrs)
+        {
+            files.write(p.first, [&](FileMeta &fm)
+            {
+                if (p.second.second.peer) fm.partial[p.second.first].addr = p.second.second;
+                else fm.partial.erase(p.second.first);
+            });
+        }
+
+        vector<pair<nameid, pair<nameid, seederaddr>>> live; // file, user, address
+        for (auto &fu : seeds)
+        {
+            peers.write(fu.second, [&](client *c)
+            {
+                c->files.insert(fu.first);
+                if (c->connected) live.push_back({fu.first, {fu.second, seederaddr{c, c->hostip, c->hostport}}});
+            });
+        }
+        files.writeall([&](nameid f, FileMeta &fm) { fm.online.clear(); });
+        for (auto &l : live)
+        {
+            files.write(l.first, [&](FileMeta &fm) { fm.online[l.second.first] = l.second.second; });
+        }
+
+        search.clear();
+        vector<pair<nameid, pair<nameid, nameid>>> listed; // content, group, file name
+        vector<pair<nameid, nameid>> members, masters; // user, group
+        groups.readall([&](nameid g, groupentry &ge)
+        {
+            for (nameid u : ge.grp->participants) members.emplace_back(u, g);
+            if (ge.grp->groupmaster != NOID) masters.emplace_back(ge.grp->groupmaster, g);
+            for (auto &it : ge.files)
+            {
+                search.add(it.first, filenames.name(it.first), g);
+                listed.push_back({it.second, {g, it.first}});
+            }
+        });
+        files.writeall([&](nameid f, FileMeta &fm) { fm.listed.clear(); });
+        for (auto &l : listed)
+        {
+            files.write(l.first, [&](FileMeta &fm) { fm.listed.push_back(l.second); });
+        }
+        peers.writeall([&](nameid u, client *c)
+        {
+            c->owned.clear();
+            c->joined.clear();
+        });
+        sort(members.begin(), members.end()); // each user's groups arrive in order, appended at the end
+        sort(masters.begin(), masters.end());
+        for (auto &m : members) peers.write(m.first, [&](client *c) { c->joined.insert(m.second); });
+        for (auto &m : masters) peers.write(m.first, [&](client *c) { c->owned.insert(m.second); });
+    }
+
+    // entry counts and a rough estimate of the bytes behind them, for the
+    // stats command: piece hashes, bitfields and id lists exact, strings at
+    // their capacity, every hash table node at a flat NODE_BYTES
+    struct sizes
+    {
+        size_t users = 0, groups = 0, files = 0, groupfiles = 0, seeders = 0;
+        size_t bytes = 0;
+    };
+    sizes measure()
+    {
+        const size_t NODE_BYTES = 64; // node, bucket slot and key header
+        const size_t ID_BYTES = sizeof(nameid);
+        sizes sz;
+        sz.bytes += usernames.bytes() + groupnames.bytes() + filenames.bytes() + contents.bytes();
+        sz.bytes += search.bytes(NODE_BYTES);
+        peers.readall([&](nameid u, client *c)
+        {
+            sz.users++;
+            sz.bytes += NODE_BYTES + sizeof(client) + c->passcode.capacity() + c->hostip.capacity();
+            sz.bytes += (c->files.ids.capacity() + c->partialfiles.ids.capacity() + c->owned.ids.capacity() + c->joined.ids.capacity()) * ID_BYTES;
+        });
+        groups.readall([&](nameid g, groupentry &ge)
+        {
+            sz.groups++;
+            sz.groupfiles += ge.files.size();
+            sz.bytes += NODE_BYTES + sizeof(group);
+            sz.bytes += ge.files.size() * 2 * NODE_BYTES;
+            sz.bytes += (ge.grp->participants.ids.capacity() + ge.grp->applicants.ids.capacity()) * ID_BYTES;
+        });
+        files.readall([&](nameid f, FileMeta &fm)
+        {
+            sz.files++;
+            sz.seeders += fm.peers.size();
+            sz.bytes += NODE_BYTES + sizeof(FileMeta) + fm.piece_hashes.capacity() * DIGEST_SIZE;
+            sz.bytes += fm.peers.ids.capacity() * ID_BYTES + fm.online.size() * NODE_BYTES;
+            sz.bytes += fm.listed.capacity() * 2 * ID_BYTES;
+            for (auto &it : fm.partial) sz.bytes += NODE_BYTES + sizeof(partialseeder) + it.second.bits.capacity();
+        });
+        return sz;
+    }
+
+    // emptying the store, used by a standby before loading its primary's snapshot
+    // (names stay interned, the snapshot reuses their ids)
+    void clear()
+    {
+        groups.clear();
+        files.clear();
+        peers.clear();
+        search.clear();
+    }
+
+    // giving back memory freed entries and shrunk lists leave behind, shard
+    // by shard so commands on other shards keep running, and the names of
+    // reclaimed entries for reuse. returns tables, entries and names done
+    size_t compact()
+    {
+        size_t done = groupnames.compact() + filenames.compact() + contents.compact();
+        done += peers.compact([](client *c) { return c->files.compact() + c->partialfiles.compact() + c->owned.compact() + c->joined.compact() > 0; });
+        done += groups.compact([](groupentry &ge)
+        {
+            bool shrunk = ge.grp->participants.compact() + ge.grp->applicants.compact() > 0;
+            if (sparse(ge.files))
+            {
+                ge.files.rehash(0);
+                shrunk = true;
+            }
+            return shrunk;
+        });
+        done += files.compact([](FileMeta &fm)
+        {
+            bool shrunk = fm.peers.compact();
+            if (sparse(fm.online) || sparse(fm.partial))
+            {
+                fm.online.rehash(0);
+                fm.partial.rehash(0);
+                shrunk = true;
+            }
+            if (fm.listed.capacity() > 2 * fm.listed.size() + 8)
+            {
+                fm.listed.shrink_to_fit();
+                shrunk = true;
+            }
+            return shrunk;
+        });
+        return done;
+    }
+};
+
+#endif
@@ -0,0 +1,476 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+// durable tracker state
+// every mutating command is appended to a write-ahead log before its reply
+// goes out, and the whole store is periodically written as a compact binary
+// snapshot. on restart the snapshot is mmap'ed and loaded, then log records
+// newer than the snapshot are replayed through the normal command handlers
+//
+// log record:  [u32 payload length][u64 seq][u32 checksum][payload]
+// snapshot:    "TRKSNAP5" [u64 seq][u64 epoch] users groups files "TRKSEND1"
+//              files are keyed by content hash, groups hold name -> content
+//              pairs. only this version is read, an older image is refused
+//              strings are [u32 length][bytes], piece hashes are raw digests,
+//              users, groups and files go by name (ids are per process)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "metastore.h"
+
+using namespace std;
+
+// FNV-1a, enough to spot a torn or garbled record
+inline uint32_t checksum(const char *data, size_t len, uint32_t h = 2166136261u)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+const size_t WAL_HEADER = 16; // length + seq + checksum
+
+// append-only log of mutating commands
+class wal
+{
+    int fd = -1;
+    string path;            // log file, rewritten by dropfront
+    uint64_t seq = 0;       // last seq written
+    atomic<uint64_t> bytes{0};  // current file size
+    atomic<bool> dirty{false};  // written since last sync
+
+public:
+    bool open(const string &p)
+    {
+        path = p;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        return fd >= 0;
+    }
+
+    uint64_t lastseq() const { return seq; }
+    uint64_t size() const { return bytes; }
+    void setseq(uint64_t s) { if (s > seq) seq = s; }
+
+    // calling fn(seq, payload) for every record newer than after
+    // a torn tail (crash mid write) is cut off so appends continue cleanly
+    template <typename F>
+    void replay(uint64_t after, F fn)
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) return;
+        const char *base = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) return;
+        madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+
+        uint64_t off = 0, total = st.st_size;
+        while (total - off >= WAL_HEADER)
+        {
+            uint32_t len, sum;
+            uint64_t recseq;
+            memcpy(&len, base + off, 4);
+            memcpy(&recseq, base + off + 4, 8);
+            memcpy(&sum, base + off + 12, 4);
+            if (total - off - WAL_HEADER < len) break;
+            const char *payload = base + off + WAL_HEADER;
+            if (checksum(payload, len, checksum((const char *)&recseq, 8)) != sum) break;
+
+            if (recseq > after) fn(recseq, string(payload, len));
+            setseq(recseq);
+            off += WAL_HEADER + len;
+        }
+        munmap((void *)base, st.st_size);
+
+        if (off < total)
+        {
+            cout << "------- Dropping " << (total - off) << " bytes of torn log tail -------" << endl;
+            if (ftruncate(fd, off) != 0) perror("ftruncate");
+        }
+        bytes = off;
+    }
+
+    // appending one record, returns its seq or 0 on failure
+    uint64_t append(const string &payload)
+    {
+        uint64_t recseq = seq + 1;
+        uint32_t len = payload.size();
+        uint32_t sum = checksum(payload.data(), len, checksum((const char *)&recseq, 8));
+        string rec(WAL_HEADER, '\0');
+        memcpy(&rec[0], &len, 4);
+        memcpy(&rec[4], &recseq, 8);
+        memcpy(&rec[12], &sum, 4);
+        rec += payload;
+
+        size_t done = 0;
+        while (done < rec.size())
+        {
+            ssize_t n = write(fd, rec.data() + done, rec.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+            {
+                perror("wal write");
+                return 0;
+            }
+            done += n;
+        }
+        seq = recseq;
+        bytes += rec.size();
+        dirty = true;
+        return seq;
+    }
+
+    // flushing to disk, called periodically so appends stay cheap
+    void sync()
+    {
+        if (!dirty.exchange(false)) return;
+        fdatasync(fd);
+    }
+
+    // dropping every record, done once a snapshot covers them
+    void reset()
+    {
+        if (ftruncate(fd, 0) != 0) perror("ftruncate");
+        fdatasync(fd);
+        bytes = 0;
+        dirty = false;
+    }
+
+    // dropping the records in the first cut bytes, once a snapshot covers them
+    // records after cut are copied to a new file that replaces the log, and fd
+    // is pointed at it in place. caller keeps appends out while this runs
+    bool dropfront(uint64_t cut)
+    {
+        if (cut >= bytes)
+        {
+            reset();
+            return true;
+        }
+        string tmp = path + ".tmp";
+        int nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (nfd < 0) return false;
+        uint64_t total = bytes;
+        char buf[1 << 16];
+        bool ok = true;
+        for (uint64_t off = cut; ok && off < total;)
+        {
+            ssize_t n = pread(fd, buf, min((uint64_t)sizeof(buf), total - off), off);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0 && write(nfd, buf, n) == n;
+            off += n > 0 ? n : 0;
+        }
+        ok = ok && fdatasync(nfd) == 0 && rename(tmp.c_str(), path.c_str()) == 0 && dup2(nfd, fd) >= 0;
+        close(nfd);
+        if (!ok)
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+        bytes = total - cut;
+        dirty = false;
+        return true;
+    }
+
+    // dropping every record and restarting numbering after s
+    // (a standby that took a snapshot from its primary)
+    void resetto(uint64_t s)
+    {
+        reset();
+        seq = s;
+    }
+};
+
+// buffered snapshot writer
+class snapwriter
+{
+    FILE *fp;
+
+public:
+    bool ok = true;
+
+    snapwriter(FILE *f) : fp(f)
+    {
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    }
+
+    void raw(const void *data, size_t len)
+    {
+        if (len && fwrite(data, 1, len, fp) != len) ok = false;
+    }
+    void u32(uint32_t v) { raw(&v, 4); }
+    void u64(uint64_t v) { raw(&v, 8); }
+    void str(string_view s)
+    {
+        u32(s.size());
+        raw(s.data(), s.size());
+    }
+    // id list written as names, ids are only meaningful inside one process
+    void names(const idset &items, const nametable &table)
+    {
+        u32(items.size());
+        for (nameid id : items) str(table.name(id));
+    }
+};
+
+// bounds checked reader over a mapped snapshot
+class snapreader
+{
+    const char *p, *end;
+
+public:
+    bool ok = true;
+
+    snapreader(const char *base, size_t len) : p(base), end(base + len) {}
+
+    const char *raw(size_t len)
+    {
+        if (!ok || (size_t)(end - p) < len)
+        {
+            ok = false;
+            return NULL;
+        }
+        const char *at = p;
+        p += len;
+        return at;
+    }
+    uint32_t u32()
+    {
+        uint32_t v = 0;
+        const char *at = raw(4);
+        if (at) memcpy(&v, at, 4);
+        return v;
+    }
+    uint64_t u64()
+    {
+        uint64_t v = 0;
+        const char *at = raw(8);
+        if (at) memcpy(&v, at, 8);
+        return v;
+    }
+    string str()
+    {
+        uint32_t len = u32();
+        const char *at = raw(len);
+        return at ? string(at, len) : string();
+    }
+    // names interned back to ids, sorted once at the end
+    void names(idset &items, nametable &table)
+    {
+        uint32_t n = u32();
+        for (uint32_t i = 0; i < n && ok; i++) items.ids.push_back(table.intern(str()));
+        sort(items.ids.begin(), items.ids.end());
+        items.ids.erase(unique(items.ids.begin(), items.ids.end()), items.ids.end());
+    }
+};
+
+// writing the whole store to fp, seq and epoch go in the header
+// caller must keep mutations out while this runs so seq matches the contents
+inline bool snapshotdump(metastore &st, uint64_t seq, uint64_t epoch, FILE *fp)
+{
+    snapwriter w(fp);
+    w.raw("TRKSNAP5", 8);
+    w.u64(seq);
+    w.u64(epoch);
+
+    w.u32(st.peers.size());
+    st.peers.readall([&](nameid u, client *c)
+    {
+        w.str(st.usernames.name(u));
+        w.str(c->passcode);
+        w.names(c->files, st.contents);
+        w.u32(c->connected); // session, so a standby sees who is online
+        w.u64(c->session);
+        w.str(c->hostip);
+        w.str(c->hostport);
+    });
+
+    w.u32(st.groups.size());
+    st.groups.readall([&](nameid g, groupentry &ge)
+    {
+        w.str(st.groupnames.name(g));
+        w.str(ge.grp->groupmaster == NOID ? string_view() : st.usernames.name(ge.grp->groupmaster));
+        w.names(ge.grp->participants, st.usernames);
+        w.names(ge.grp->applicants, st.usernames);
+        w.u32(ge.files.size());
+        for (auto &it : ge.files)
+        {
+            w.str(st.filenames.name(it.first));
+            w.str(st.contents.name(it.second));
+        }
+    });
+
+    w.u32(st.files.size());
+    st.files.readall([&](nameid f, FileMeta &fm)
+    {
+        w.str(st.contents.name(f));
+        w.u64(fm.size);
+        w.str(fm.fullhash);
+        w.u32(fm.num_pieces);
+        w.u32(fm.piece_hashes.size());
+        w.raw(fm.piece_hashes.data(), fm.piece_hashes.size() * DIGEST_SIZE);
+        w.names(fm.peers, st.usernames);
+        w.u32(fm.partial.size()); // addresses come from the users on load
+        for (auto &it : fm.partial)
+        {
+            w.str(st.usernames.name(it.first));
+            w.u32(it.second.bits.size());
+            w.raw(it.second.bits.data(), it.second.bits.size());
+        }
+    });
+    w.raw("TRKSEND1", 8);
+    return w.ok && fflush(fp) == 0;
+}
+
+// writing the whole store to path (via a temp file and rename)
+inline bool snapshotwrite(metastore &st, uint64_t seq, uint64_t epoch, const string &path)
+{
+    string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+    bool ok = snapshotdump(st, seq, epoch, fp) && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// writing a snapshot image taken with snapshotdump to path (via a temp file
+// and rename), without holding up mutations while it goes to disk
+inline bool snapshotsave(const string &image, const string &path)
+{
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    for (size_t done = 0; ok && done < image.size();)
+    {
+        ssize_t n = write(fd, image.data() + done, image.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        done += n > 0 ? n : 0;
+    }
+    ok = ok && !image.empty() && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// loading a snapshot image into an empty store
+// seq gets the last log seq it covers, epoch the primary term it was taken in
+inline bool snapshotparse(metastore &st, const char *base, size_t len, uint64_t &seq, uint64_t &epoch)
+{
+    snapreader r(base, len);
+    const char *magic = r.raw(8);
+    if (!magic || memcmp(magic, "TRKSNAP5", 8) != 0) return false;
+    seq = r.u64();
+    epoch = r.u64();
+
+    uint32_t n = r.u32();
+    for (uint32_t i = 0; i < n && r.ok; i++)
+    {
+        string name = r.str(), pass = r.str();
+        unique_ptr<client> c = make_unique<client>(pass);
+        r.names(c->files, st.contents);
+        bool online = r.u32() != 0;
+        c->session = r.u64();
+        string ip = r.str(), port = r.str();
+        if (online) c->login(ip, port);
+        st.peers.insert(st.usernames.intern(name), move(c));
+    }
+
+    n = r.u32();
+    for (uint32_t i = 0; i < n && r.ok; i++)
+    {
+        string gid = r.str(), master = r.str();
+        nameid g = st.groupnames.intern(gid);
+        groupentry ge;
+        ge.grp = make_unique<group>(master.empty() ? NOID : st.usernames.intern(master));
+        ge.grp->participants.clear();
+        r.names(ge.grp->participants, st.usernames);
+        r.names(ge.grp->applicants, st.usernames);
+        uint32_t nf = r.u32();
+        for (uint32_t j = 0; j < nf && r.ok; j++)
+        {
+            nameid fn = st.filenames.intern(r.str());
+            ge.addfile(fn, st.contents.intern(r.str()), st.filenames);
+        }
+        st.groups.insert(g, move(ge));
+    }
+
+    n = r.u32();
+    for (uint32_t i = 0; i < n && r.ok; i++)
+    {
+        string key = r.str(); // content hash
+        FileMeta rec;
+        rec.size = r.u64();
+        rec.fullhash = r.str();
+        rec.num_pieces = r.u32();
+        uint32_t nh = r.u32();
+        const char *hashes = r.raw((size_t)nh * DIGEST_SIZE);
+        if (hashes)
+        {
+            rec.piece_hashes.resize(nh);
+            memcpy(rec.piece_hashes.data(), hashes, (size_t)nh * DIGEST_SIZE); // bulk copy out of the image
+        }
+        r.names(rec.peers, st.usernames);
+        uint32_t np = r.u32();
+        for (uint32_t j = 0; j < np && r.ok; j++)
+        {
+            partialseeder &ps = rec.partial[st.usernames.intern(r.str())];
+            uint32_t nb = r.u32();
+            const char *bits = r.raw(nb);
+            if (!bits) break;
+            ps.bits.assign(bits, bits + nb);
+            for (uint32_t b = 0; b < nb; b++) ps.have += __builtin_popcount((uint8_t)bits[b]);
+        }
+        st.files.upsert(st.contents.intern(key), [&](FileMeta &fm) { fm = move(rec); });
+    }
+
+    const char *endmagic = r.raw(8);
+    if (!r.ok || !endmagic || memcmp(endmagic, "TRKSEND1", 8) != 0) return false;
+    st.reindex(); // online seeder index and partial seeder addresses are not stored
+    return true;
+}
+
+// loading snapshot file into an empty store
+// returns false only for a present but unreadable snapshot
+inline bool snapshotload(metastore &st, const string &path, uint64_t &seq, uint64_t &epoch)
+{
+    seq = epoch = 0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return true; // no snapshot yet
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0)
+    {
+        close(fd);
+        return sb.st_size == 0;
+    }
+    const char *base = (const char *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    madvise((void *)base, sb.st_size, MADV_SEQUENTIAL); // one advice per call, they do not combine
+    madvise((void *)base, sb.st_size, MADV_WILLNEED);
+    bool ok = snapshotparse(st, base, sb.st_size, seq, epoch);
+    munmap((void *)base, sb.st_size);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+// admission control for tracker commands
+// every command costs units (cheap lookups 1, page and metadata replies more,
+// lease renewals and tracker generated commands nothing) and is paid from two
+// token buckets: the connection's and, once it has logged in, the user's,
+// which all of that user's connections share. a command either bucket cannot
+// pay is turned away at once with "RETRY_AFTER <ms>", never queued, so one
+// flooding client costs the others a bucket check and nothing else
+//
+// buckets hold two seconds of their rate, enough for the batches a client
+// pipelines. rates and costs change at runtime from the tracker console
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "stats.h"
+#include "metastore.h"
+
+using namespace std;
+
+const int DEFAULT_CONN_RATE = 2000;     // units per second per connection
+const int DEFAULT_USER_RATE = 4000;     // units per second per user, over all its connections
+const int BURST_SECONDS = 2;            // bucket size in seconds of rate
+const int LIMIT_STRIPES = 64;           // user bucket locks
+
+// commands that cost other than 1 unit, the rest of statcomds cost 1
+const vector<pair<string, int>> defaultcosts = {
+    {"list_files", 4}, {"search_files", 4}, {"list_groups", 4}, {"download_file", 4},
+    {"upload_file", 2}, {"add_piece_hashes", 2}, {"get_piece_hashes", 2}, {"stats", 20},
+    {"heartbeat", 0}, {"tracker_role", 0}, {"replicate", 0}, {"peer_disconnected", 0},
+    {"lease_expired", 0}, {"tracker_restarted", 0}, {"tracker_promoted", 0}, {"reclaim", 0},
+};
+
+struct tokenbucket
+{
+    double tokens = -1;     // units left, negative until first use (starts full)
+    int64_t refilled = 0;   // last refill, steady clock ns
+
+    // refilling to now, then whether cost can be paid. if not, wait is how
+    // many ms until it can
+    bool canpay(double cost, double rate, int64_t now, int64_t &waitms)
+    {
+        double burst = rate * BURST_SECONDS;
+        if (tokens < 0) tokens = burst;
+        else tokens = min(burst, tokens + (now - refilled) * 1e-9 * rate);
+        refilled = now;
+        cost = min(cost, burst); // a command dearer than a whole bucket still gets through when it is full
+        if (tokens >= cost) return true;
+        waitms = max(waitms, (int64_t)ceil((cost - tokens) * 1000 / rate));
+        return false;
+    }
+
+    void pay(double cost, double rate)
+    {
+        tokens = max(0.0, tokens - min(cost, rate * BURST_SECONDS));
+    }
+};
+
+class ratelimiter
+{
+    struct stripe
+    {
+        mutex mtx;
+        unordered_map<nameid, tokenbucket> users; // user to bucket
+    };
+    stripe stripes[LIMIT_STRIPES];
+    atomic<int> costs[MAX_STAT_COMDS];  // units per command, by stats slot
+
+public:
+    atomic<int> connrate{DEFAULT_CONN_RATE}; // 0 for no limit
+    atomic<int> userrate{DEFAULT_USER_RATE}; // 0 for no limit
+    atomic<uint64_t> refused{0};             // commands turned away
+
+    ratelimiter()
+    {
+        for (auto &c : costs) c.store(1, memory_order_relaxed);
+        for (auto &dc : defaultcosts) setcost(dc.first, dc.second);
+    }
+
+    static int64_t now()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int cost(int slot) const { return costs[slot].load(memory_order_relaxed); }
+
+    // false if comd has no stats slot of its own (it is priced as "other")
+    bool setcost(string_view comd, int units)
+    {
+        auto it = find(statcomds.begin(), statcomds.end(), comd);
+        if (it == statcomds.end()) return false;
+        costs[it - statcomds.begin()].store(max(0, units), memory_order_relaxed);
+        return true;
+    }
+
+    // charging a command of stats slot to the connection's bucket (owned by
+    // the caller's thread) and to user's (NOID before login). returns 0 when
+    // admitted, otherwise the ms to wait; nothing is charged then
+    int64_t admit(int slot, tokenbucket &conn, nameid user)
+    {
+        double c = cost(slot);
+        int cr = connrate.load(memory_order_relaxed), ur = userrate.load(memory_order_relaxed);
+        if (c == 0 || (cr == 0 && ur == 0)) return 0;
+        int64_t t = now(), wait = 0;
+        if (cr > 0 && !conn.canpay(c, cr, t, wait))
+        {
+            refused.fetch_add(1, memory_order_relaxed);
+            return wait;
+        }
+        if (ur > 0 && user != NOID)
+        {
+            stripe &s = stripes[user % LIMIT_STRIPES];
+            lock_guard<mutex> lock(s.mtx);
+            tokenbucket &b = s.users[user];
+            if (!b.canpay(c, ur, t, wait))
+            {
+                refused.fetch_add(1, memory_order_relaxed);
+                return wait;
+            }
+            b.pay(c, ur);
+        }
+        if (cr > 0) conn.pay(c, cr);
+        return 0;
+    }
+
+    // forgetting user buckets that have refilled, a missing bucket starts
+    // full so nothing changes for their users. returns buckets dropped
+    size_t trim()
+    {
+        int ur = userrate.load(memory_order_relaxed);
+        int64_t t = now(), full = (int64_t)BURST_SECONDS * 1000000000; // ns a drained bucket takes to refill
+        size_t dropped = 0;
+        for (auto &s : stripes)
+        {
+            lock_guard<mutex> lock(s.mtx);
+            for (auto it = s.users.begin(); it != s.users.end();)
+            {
+                if (ur == 0 || t - it->second.refilled >= full)
+                {
+                    it = s.users.erase(it);
+                    dropped++;
+                }
+                else ++it;
+            }
+            if (sparse(s.users)) s.users.rehash(0);
+        }
+        return dropped;
+    }
+
+    // "conn <rate> user <rate>" and every cost that is not 1
+    string describe()
+    {
+        string out = "conn " + to_string(connrate.load()) + "/s user " + to_string(userrate.load()) + "/s, costs";
+        for (size_t i = 0; i < statcomds.size(); i++)
+        {
+            if (cost(i) != 1) out += " " + statcomds[i] + "=" + to_string(cost(i));
+        }
+        return out;
+    }
+};
+
+#endif
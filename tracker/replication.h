@@ -0,0 +1,128 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+// hot standby replication by log shipping
+// the primary sends every write-ahead log record to its standbys as it is
+// written, standbys apply them through the normal command handlers and log
+// them under the same seq, so their log, snapshot and state match the primary
+//
+// standby -> primary:  FRAME_COMMAND "replicate <tracker_no> <epoch> <last seq>"
+// primary -> standby:  FRAME_REPLY "REPLICATING <tracker_no> <epoch> <seq>"
+//                      then FRAME_SNAPSHOT chunks (only if it cannot catch up
+//                      from the backlog, an empty chunk ends the image)
+//                      then FRAME_LOG [u64 seq][payload], seq 0 is a heartbeat
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../common/frame.h"
+
+using namespace std;
+
+const size_t SNAPSHOT_CHUNK = 1024 * 1024; // snapshot bytes per frame
+const size_t BACKLOG_BLOCK = 1024 * 1024; // backlog record bytes per block
+
+// appending one log record frame
+inline void appendlogframe(string &out, uint64_t seq, string_view payload)
+{
+    uint32_t netlen = htonl((uint32_t)(8 + payload.size())); // length
+    out.append((const char *)&netlen, sizeof(netlen));
+    out.push_back((char)FRAME_LOG);
+    out.append((const char *)&seq, 8);
+    out += payload;
+}
+
+// most recent log records kept in memory, a standby that reconnects after a
+// short gap catches up from here instead of taking a whole snapshot
+// record bytes are packed into blocks of BACKLOG_BLOCK, freed once their last
+// record is dropped, so the backlog never holds single records scattered over
+// heap pages that reclaimed metadata freed
+class replbacklog
+{
+    struct record
+    {
+        uint64_t seq;
+        uint64_t block;     // number of the block holding it
+        size_t off, len;    // where in the block
+    };
+    mutex mtx;
+    condition_variable cv;              // signalled on every new record
+    deque<record> recs;                 // contiguous seqs, oldest first
+    deque<string> blocks;               // record bytes, oldest first
+    uint64_t firstblock = 0;            // number of blocks.front()
+    size_t bytes = 0;                   // payload bytes held
+    size_t limit;                       // dropping oldest past this
+
+    string_view payload(const record &r)
+    {
+        return string_view(blocks[r.block - firstblock]).substr(r.off, r.len);
+    }
+
+public:
+    replbacklog(size_t max) : limit(max) {}
+
+    void push(uint64_t seq, const string &payload)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!recs.empty() && seq != recs.back().seq + 1) // numbering restarted (snapshot from primary)
+            {
+                recs.clear();
+                blocks.clear();
+                bytes = 0;
+            }
+            if (blocks.empty() || blocks.back().size() + payload.size() > blocks.back().capacity())
+            {
+                blocks.emplace_back();
+                blocks.back().reserve(max(BACKLOG_BLOCK, payload.size()));
+            }
+            recs.push_back({seq, firstblock + blocks.size() - 1, blocks.back().size(), payload.size()});
+            blocks.back() += payload;
+            bytes += payload.size();
+            while (bytes > limit && recs.size() > 1)
+            {
+                bytes -= recs.front().len;
+                recs.pop_front();
+                while (firstblock < recs.front().block)
+                {
+                    blocks.pop_front();
+                    firstblock++;
+                }
+            }
+        }
+        cv.notify_all();
+    }
+
+    // checking every record after seq up to last is still held
+    bool covers(uint64_t seq, uint64_t last)
+    {
+        lock_guard<mutex> lock(mtx);
+        if (seq == last) return true;
+        return !recs.empty() && recs.front().seq <= seq + 1 && recs.back().seq == last;
+    }
+
+    // waiting up to ms for records newer than seq and appending them to out as
+    // log frames, seq advances to the last one taken
+    // false when the records right after seq were already dropped
+    bool collect(uint64_t &seq, string &out, int ms)
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait_for(lock, chrono::milliseconds(ms), [&]() { return !recs.empty() && recs.back().seq > seq; });
+        if (recs.empty() || recs.back().seq <= seq) return true; // nothing new
+        if (recs.front().seq > seq + 1) return false;
+        for (size_t i = seq + 1 - recs.front().seq; i < recs.size(); i++)
+        {
+            appendlogframe(out, recs[i].seq, payload(recs[i]));
+            seq = recs[i].seq;
+        }
+        return true;
+    }
+};
+
+#endif
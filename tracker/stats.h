@@ -0,0 +1,211 @@
+#ifndef STATS_H
+#define STATS_H
+
+// tracker load statistics
+// every thread that runs commands owns a block of counters and is the only
+// one writing it (relaxed load and store, no read-modify-write, no locks),
+// so counting costs the hot path a clock read and a few plain stores.
+// the stats command sums the blocks of every thread when asked
+//
+// latencies go into log-linear buckets: 8 per power of two of microseconds,
+// so a reported percentile is at most 12.5% above the true value
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+// commands with their own counters, the rest are counted as "other"
+const vector<string> statcomds = {
+    "create_user", "login", "logout", "create_group", "join_group", "leave_group",
+    "list_requests", "accept_request", "list_groups", "list_files", "upload_file",
+    "add_piece_hashes", "download_file", "file_info", "get_piece_hashes", "file_downloaded",
+    "have_pieces", "stop_share", "heartbeat", "report_peers", "peer_disconnected",
+    "lease_expired", "tracker_restarted", "tracker_promoted", "tracker_role", "replicate",
+    "stats", "search_files", "subscribe", "unsubscribe", "reclaim", "copy_user", "sync_user",
+    "tracker_auth",
+    "other",
+};
+const size_t MAX_STAT_COMDS = 40;   // room in the per-thread arrays
+const int LATENCY_BUCKETS = 8 * 41; // up to 2^40 us
+
+// bucket of a latency in us
+inline int latencybucket(uint64_t us)
+{
+    if (us < 8) return (int)us;
+    int msb = 63 - __builtin_clzll(us); // at least 3
+    int b = (msb - 2) * 8 + (int)((us >> (msb - 3)) & 7);
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+// largest latency in us that falls in bucket b
+inline uint64_t bucketlimit(int b)
+{
+    if (b < 8) return b;
+    int shift = b / 8 - 1;
+    return ((uint64_t)(8 + b % 8 + 1) << shift) - 1;
+}
+
+// counters owned by one thread
+struct threadstats
+{
+    atomic<uint64_t> calls[MAX_STAT_COMDS];                    // per command
+    atomic<uint64_t> latency[MAX_STAT_COMDS][LATENCY_BUCKETS]; // per command histogram
+    atomic<uint64_t> bytesin{0}, bytesout{0};                  // socket traffic
+    atomic<uint64_t> opened{0}, closed{0};                     // client connections
+    atomic<uint64_t> streams{0}, streamsdone{0};               // standby log streams
+    atomic<bool> owned{false};                                 // a live thread writes here
+
+    threadstats()
+    {
+        for (auto &c : calls) c.store(0, memory_order_relaxed);
+        for (auto &h : latency) for (auto &b : h) b.store(0, memory_order_relaxed);
+    }
+};
+
+// owner only, a plain store is enough with a single writer
+inline void bump(atomic<uint64_t> &counter, uint64_t n = 1)
+{
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+class trackerstats
+{
+    mutex mtx;                      // guards blocks, taken once per thread
+    vector<threadstats *> blocks;   // every thread's counters, reused after it exits
+    unordered_map<string_view, int> index; // command to slot, keys view statcomds
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+public:
+    trackerstats()
+    {
+        for (size_t i = 0; i < statcomds.size(); i++) index[statcomds[i]] = i;
+    }
+
+    // counters of the calling thread, handed back when the thread exits
+    // a block taken over keeps its counts, so totals still cover the old owner
+    threadstats &mine()
+    {
+        struct owner
+        {
+            threadstats *block = nullptr;
+            ~owner() { if (block) block->owned.store(false, memory_order_release); }
+        };
+        static thread_local owner me;
+        if (!me.block)
+        {
+            lock_guard<mutex> lock(mtx);
+            for (threadstats *t : blocks)
+            {
+                if (!t->owned.load(memory_order_acquire))
+                {
+                    me.block = t;
+                    break;
+                }
+            }
+            if (!me.block)
+            {
+                me.block = new threadstats();
+                blocks.push_back(me.block);
+            }
+            me.block->owned.store(true, memory_order_relaxed);
+        }
+        return *me.block;
+    }
+
+    int slot(string_view comd)
+    {
+        auto it = index.find(comd);
+        return it != index.end() ? it->second : (int)statcomds.size() - 1;
+    }
+
+    void record(int slot, uint64_t us)
+    {
+        threadstats &t = mine();
+        bump(t.calls[slot]);
+        bump(t.latency[slot][latencybucket(us)]);
+    }
+
+    long long uptime()
+    {
+        return chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - started).count();
+    }
+
+    // sum of one counter over every thread
+    template <typename F>
+    uint64_t total(F field)
+    {
+        lock_guard<mutex> lock(mtx);
+        uint64_t sum = 0;
+        for (threadstats *t : blocks) sum += field(*t).load(memory_order_relaxed);
+        return sum;
+    }
+
+    // one line per command seen: count and latency percentiles in us
+    string commandlines()
+    {
+        vector<uint64_t> hist(LATENCY_BUCKETS);
+        string out;
+        for (size_t c = 0; c < statcomds.size(); c++)
+        {
+            uint64_t calls = 0;
+            fill(hist.begin(), hist.end(), 0);
+            {
+                lock_guard<mutex> lock(mtx);
+                for (threadstats *t : blocks)
+                {
+                    calls += t->calls[c].load(memory_order_relaxed);
+                    for (int b = 0; b < LATENCY_BUCKETS; b++) hist[b] += t->latency[c][b].load(memory_order_relaxed);
+                }
+            }
+            if (calls == 0) continue;
+
+            // counts and buckets are read separately, so ranking goes by the histogram's own total
+            uint64_t seen = 0;
+            for (uint64_t h : hist) seen += h;
+            const double quantiles[] = {0.5, 0.99, 0.999};
+            uint64_t values[3] = {0, 0, 0};
+            for (int q = 0; q < 3; q++)
+            {
+                uint64_t rank = (uint64_t)(quantiles[q] * seen); // samples below the quantile
+                uint64_t below = 0;
+                for (int b = 0; b < LATENCY_BUCKETS; b++)
+                {
+                    below += hist[b];
+                    if (below > rank)
+                    {
+                        values[q] = bucketlimit(b);
+                        break;
+                    }
+                }
+            }
+            out += "cmd " + statcomds[c] + " count " + to_string(calls) + " p50_us " + to_string(values[0]) +
+                   " p99_us " + to_string(values[1]) + " p999_us " + to_string(values[2]) + "\n";
+        }
+        return out;
+    }
+};
+
+// times one command into its slot when it goes out of scope
+struct commandtimer
+{
+    trackerstats &stats;
+    int slot;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    commandtimer(trackerstats &s, string_view comd) : stats(s), slot(s.slot(comd)) {}
+    ~commandtimer()
+    {
+        auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        stats.record(slot, us < 0 ? 0 : us);
+    }
+};
+
+#endif
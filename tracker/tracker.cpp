@@ -10,695 +10,2755 @@
 #include <string> 
 #include <unordered_map> 
 #include <stdlib.h> 
+#include <limits.h> 
 #include <unordered_set> 
 #include <sstream> 
+#include <sys/epoll.h> // for event loop
+#include <fcntl.h> 
+#include <errno.h> 
+#include "metastore.h" // users, groups, files
+#include "../common/frame.h" // tracker protocol framing
+#include "../common/shardmap.h" // groups to tracker shards
+#include "persist.h" // write-ahead log and snapshots
+#include "replication.h" // log shipping to standby trackers
+#include "stats.h" // per-thread counters and latency histograms
+#include "command.h" // tokenizer and reply parts
+#include "logger.h" // asynchronous leveled logging
+#include "events.h" // subscriptions and pushed events
+#include "ratelimit.h" // per connection and per user command budgets
+#include <atomic> 
+#include <chrono>
+#include <random> // peer sampling
+#include <math.h>  
+#include <malloc.h> // malloc_trim after reclaiming
+#include <deque> 
+#include <condition_variable> 
+#include <fstream> 
 
 using namespace std;
 
-// representing peer/client in the P2P network
-struct client 
+// users, groups, group-files and files, sharded with reader-writer locks
+metastore store;
+
+// durability: mutations are applied and logged in one order under mutationmtx
+// so replaying the log rebuilds exactly the same state, readers never take it
+wal trackerlog;         // write-ahead log
+mutex mutationmtx;      // orders mutations and their log records
+mutex snapshotmtx;      // one snapshot written at a time
+string snapshotpath;    // snapshot file
+const int SNAPSHOT_INTERVAL = 60;                       // seconds between snapshots
+const uint64_t SNAPSHOT_LOG_BYTES = 64 * 1024 * 1024;   // or sooner once log is this big
+
+// replication: every tracker of our shard in tracker_info.txt holds the full
+// state of the shard. the primary ships its log to the standbys, standbys serve
+// read-only commands and the lowest numbered live standby takes over when the
+// primary goes away
+vector<pair<string, string>> trackeraddrs; // ip and port of every tracker of our shard
+int trackerno = 1;                  // this tracker, numbered within our shard
+atomic<bool> isprimary(false);      // accepting mutations
+atomic<int> primaryno(0);           // primary we follow, 0 if unknown
+atomic<uint64_t> trackerepoch(0);   // primary term our history belongs to
+replbacklog backlog(64 * 1024 * 1024);  // recent records for catching up standbys
+const int REPL_HEARTBEAT_MS = 1000; // primary -> standby keepalive
+const int REPL_TIMEOUT_SEC = 3;     // standby gives up on a silent primary
+const int ELECTION_ROUND_MS = 500;  // pause between rounds looking for a primary
+const int MAX_STANDBY_STREAMS = 8;  // log streams (shiplog threads) a primary runs at once
+atomic<int> standbystreams(0);      // streams running or about to start
+
+// sharding: with more than one shard in tracker_info.txt each shard owns the
+// groups the ring gives it and turns away commands for the others' groups.
+// users are not sharded: a user is created on its home shard (the ring's
+// owner of its name), whose primary copies it to every other shard with
+// copy_user. a shard takes that copy only from the home shard's trackers
+shardring ring;         // every shard, by group id
+int trackershard = 1;   // shard we belong to
+vector<trackeraddr> alltrackers;    // every tracker of every shard
+const int FORWARD_RETRY_MS = 1000;  // pause before a shard that could not be reached is tried again
+mutex forwardmtx;                   // guards forwards
+condition_variable forwardcv;       // copies queued
+deque<pair<int, string>> forwards;  // shard, copy_user command still to reach it
+
+// trackers prove to each other that they are part of this deployment with the
+// secret in tracker_secret.txt, once per connection with tracker_auth, before
+// replicate or copy_user. the addresses in tracker_info.txt alone prove nothing
+// when trackers share a host with clients
+const char *SECRET_FILE = "tracker_secret.txt";
+string trackersecret;   // same in every tracker, empty for a lone tracker
+
+// seeder leases: a login holds a lease the client renews with heartbeat, a
+// seeder whose lease runs out is taken offline so downloaders stop getting it
+const int LEASE_SECONDS = 15;       // lease length, clients heartbeat every 5 s
+
+// reclamation: groups nobody is left in and contents nobody seeds or no group
+// lists are dropped once the reaper has seen them that way for the grace
+// period, then sparse tables are shrunk and freed memory goes back to the OS
+const int GC_INTERVAL_SECONDS = 30;         // between reaper sweeps
+atomic<int> gcgrace(600);                   // seconds an entry stays idle before it is reclaimed
+atomic<uint64_t> gcgroups(0), gcfiles(0);   // reclaimed so far
+atomic<size_t> gcidle(0);                   // candidates waiting out the grace period
+
+// peer lists are a ranked sample of the online seeders, weighted by how well
+// downloaders say a peer served them, how busy it reports being and how
+// recently it heartbeated. sampled rather than sorted so downloaders of the
+// same file do not all pile onto the same few peers
+const size_t MAX_PEERS_RETURNED = 32; // seeders per peer list
+const size_t MAX_PARTIAL_RETURNED = 16; // partial seeders per peer list, each costs its bitfield
+
+trackerstats loadstats; // command counts and latencies, traffic, connections
+asynclog &logger = *new asynclog(); // never destroyed, its drain thread runs till exit
+eventhub notifier; // who is subscribed to what, events go out through it
+ratelimiter limiter; // command costs and the per user budgets
+int workerthreads = 0;  // event loop workers
+
+// names to ids, looked up once per command where they come off the wire
+// a name never seen gets NOID, which no map has an entry for
+nameid userid(string_view name) 
+{
+    return store.usernames.find(name);
+}
+
+nameid groupid(string_view name) 
+{
+    return store.groupnames.find(name);
+}
+
+nameid fileid(string_view name) 
+{
+    return store.filenames.find(name);
+}
+
+// checking existence of group and user
+bool isgrouppresent(nameid g) 
+{
+    return store.groups.contains(g); // checking group
+}
+
+bool isuserpresent(nameid u) 
+{
+    return store.peers.contains(u); // checking user
+}
+
+// steady clock in ms, for leases
+long long nowms() 
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void renewlease(client *peer) 
 {
-    string hostip, hostport, peername, passcode;    // info for peer
-    unordered_map<string, string> filmaptopath;     // file map
-    bool connected = false;     // checking for connected
+    peer->leaseuntil.store(nowms() + LEASE_SECONDS * 1000LL, memory_order_relaxed);
+}
+
+// online seeder worth handing out, standbys get no heartbeats and go by the
+// primary's lease_expired records instead
+bool leaselive(client *peer, long long now) 
+{
+    return !isprimary || peer->leaseuntil.load(memory_order_relaxed) > now;
+}
 
-    client(string& username, string& code)
-        : peername(username), passcode(code), connected(false) {} // constructor
+// online seeder index: every file keeps its logged in seeders so peer lists
+// cost what they return, kept up here by every command that changes either
+// side (never takes a file shard inside a user accessor)
 
-    void login(string& ip, string& port) 
+// telling subscribers of content f that u came online as its seeder (at addr)
+// or went away (addr NULL), called with no shard held
+void seederevent(nameid f, nameid u, const seederaddr *addr) 
+{
+    uint64_t t = topicof(TOPIC_FILE, f);
+    if (addr) notifier.publish(t, "SEEDER_JOINED ", store.contents.name(f), ' ', store.usernames.name(u), ' ', addr->ip, ' ', addr->port);
+    else notifier.publish(t, "SEEDER_LEFT ", store.contents.name(f), ' ', store.usernames.name(u));
+}
+
+// adding or dropping user in the online index of every file it seeds
+// partial seeders follow the user's new address, or are dropped when it goes
+// offline since the pieces they announced can no longer be fetched
+void setonline(nameid u, bool online) 
+{
+    vector<nameid> files, partials; // files user seeds, has pieces of
+    seederaddr addr; // where it can be reached
+    store.peers.write(u, [&](client *p) 
+    {
+        files = p->files.ids;
+        partials = p->partialfiles.ids;
+        online = online && p->connected;
+        if (!online) p->partialfiles.clear();
+        addr = seederaddr{p, p->hostip, p->hostport};
+    });
+    bool notify = notifier.subscriptions() > 0; // someone may want seeder events
+    static thread_local vector<nameid> changed; // files whose online seeders changed
+    changed.clear();
+    for (nameid f : files) 
+    {
+        store.files.write(f, [&](FileMeta &fm) 
+        {
+            if (online && fm.peers.contains(u)) 
+            {
+                fm.online[u] = addr;
+                if (notify) changed.push_back(f);
+            } 
+            else if (fm.online.erase(u) && notify) changed.push_back(f);
+        });
+    }
+    for (nameid f : changed) seederevent(f, u, online ? &addr : NULL);
+    for (nameid f : partials) 
     {
-        hostip = ip;        // setting ip
-        hostport = port;    // setting port
-        connected = true;   // setting connected
+        store.files.write(f, [&](FileMeta &fm) 
+        {
+            auto it = fm.partial.find(u);
+            if (it == fm.partial.end()) return;
+            if (online) it->second.addr = addr;
+            else fm.partial.erase(it);
+        });
     }
+}
 
-    void logout() 
+// user now seeds content: file list, seeder set and, if logged in, online index
+void addseeder(nameid f, nameid u) 
+{
+    bool online = false; // logged in
+    seederaddr addr; // where it can be reached
+    store.peers.write(u, [&](client *p) 
     {
-        connected = false;  // setting not connected
-        hostip.clear();     // clearing ip
-        hostport.clear();   // clearing port
-    }
+        p->files.insert(f); // adding file
+        p->partialfiles.erase(f); // has every piece now
+        online = p->connected;
+        addr = seederaddr{p, p->hostip, p->hostport};
+    });
+    store.files.write(f, [&](FileMeta &fm) 
+    {
+        fm.peers.insert(u); // adding peer
+        fm.partial.erase(u);
+        if (online) fm.online[u] = addr;
+    });
+    if (online) seederevent(f, u, &addr);
+}
+
+// user leaves group g, a leaving owner hands it to the member with the
+// smallest name. called under the group's lock, the users' owned and joined
+// indexes follow (group -> user lock order)
+void removemember(nameid g, groupentry &ge, nameid u) 
+{
+    bool handover = ge.grp->deluser(u, store.usernames); // u was the master
+    nameid master = ge.grp->groupmaster; // after
+    store.peers.write(u, [&](client *p) 
+    {
+        p->joined.erase(g);
+        if (handover) p->owned.erase(g);
+    });
+    if (!handover) return;
+    if (master != NOID) 
+    {
+        store.peers.write(master, [&](client *p) { p->owned.insert(g); });
+        logger.line(LOG_INFO, "Group ", store.groupnames.name(g), " new owner is: ", store.usernames.name(master));
+    } 
+    else logger.line(LOG_INFO, "Group ", store.groupnames.name(g), " has no members left");
+}
+
+// per connection state owned by the event loop
+struct connection 
+{
+    int fd;                     // socket
+    string inbuf;               // bytes read but not framed yet
+    string outbuf;              // reply frames not written yet
+    size_t outoff = 0;          // bytes of outbuf already written
+    string disconnecting_user;  // user to disconnect
+    uint64_t session = 0;       // login session opened on this connection
+    bool internal = false;      // tracker generated commands, allowed internal-only commands
+    bool replaying = false;     // command comes from the log, not logged again
+    bool tagged = false;        // current command came as FRAME_REQUEST
+    uint32_t reqid = 0;         // its request id, echoed on the reply
+    int replies = 0;            // replies queued for current command
+    int peershard = 0;          // tracker of this shard on the other end, proven with tracker_auth
+    int standbyno = 0;          // standby asking for the log stream, connection leaves the event loop
+    uint64_t standbyepoch = 0, standbyseq = 0; // where that standby's history ends
+    pushqueue push;             // events for this connection's subscriptions, shares the socket
+    nameid user = NOID;         // logged in here, its budget pays for commands too
+    tokenbucket budget;         // this connection's command budget
+
+    connection(int sock) : fd(sock) { push.fd = sock; } // constructor
 };
 
-// representing a group in the P2P network
-class group 
+// starting a reply frame in the connection's output buffer, the reply is
+// appended in place and endreply fills in its length. outbuf keeps its
+// capacity, so replies stop allocating once it has grown
+// replies to pipelined commands go out together in one send
+// tagged requests get their id back so the client can match out of order replies
+size_t beginreply(connection *conn) 
+{
+    if (conn->tagged) return begintagged(conn->outbuf, FRAME_RESPONSE, conn->reqid);
+    return beginframe(conn->outbuf, FRAME_REPLY);
+}
+
+void endreply(connection *conn, size_t at) 
 {
-public:
-    string gid;         // group id
-    string groupmaster; // group master
-    unordered_set<string> participants, applicants; // members and requests
+    endframe(conn->outbuf, at);
+    conn->replies++;
+}
+
+// queueing reply made of parts (text, numbers), it is written out by the event loop
+template <typename... P>
+void reply(connection *conn, const P &... parts) 
+{
+    size_t at = beginreply(conn);
+    put(conn->outbuf, parts...);
+    endreply(conn, at);
+}
 
-    group(string id, string name) 
+void managepeer(connection *conn, string_view comd);
+
+// on disconnect, mark user offline and transfer group ownership if required
+// goes through managepeer as an internal command so it is logged like any mutation
+void peerdisconnected(connection *conn) 
+{
+    logger.line(LOG_INFO, "Socket received 0 bytes: ", conn->fd);
+    if (!conn->disconnecting_user.empty()) 
     {
-        gid = id; // setting id
-        groupmaster = name; // setting master
-        participants.insert(name); // adding master to group
+        connection internal(-1); // tracker generated
+        internal.internal = true;
+        string comd; // command
+        put(comd, "peer_disconnected ", conn->disconnecting_user, ' ', conn->session);
+        managepeer(&internal, comd);
     }
+}
 
-    // checking applicant
-    bool isapplicant(string s) 
-    { 
-        return applicants.find(s) != applicants.end(); 
+const int MAX_HASH_RANGE = 8192; // piece hashes per get_piece_hashes reply
+const long long MAX_PIECES = 1 << 21; // pieces per file (1 TB), each costs a 20-byte hash
+const size_t MAX_LIST_PAGE = 1000; // files per list_files page
+const size_t MAX_LIST_SCAN = 16 * MAX_LIST_PAGE; // names one list_files page looks at
+const size_t MAX_SEARCH_SCAN = 16 * MAX_LIST_PAGE; // candidate names one search_files page looks at
+
+// splitting a "key=value" option token, false if it has no '='
+bool splitoption(string_view tok, string_view &key, string_view &val) 
+{
+    size_t eq = tok.find('=');
+    if (eq == string_view::npos) return false;
+    key = tok.substr(0, eq);
+    val = tok.substr(eq + 1);
+    return true;
+}
+
+// checking user is member of group and file is uploaded there
+// f gets the content the group's file name stands for and u the user id,
+// on failure the error is replied
+bool canaccessfile(connection *conn, string_view gid, string_view fname, string_view uname, nameid &f, nameid &u) 
+{
+    u = userid(uname);
+    f = NOID;
+    nameid fn = fileid(fname); // name in the group
+    bool present = isuserpresent(u); // is user registered
+    bool member = false; // user in group
+
+    bool found = store.groups.read(groupid(gid), [&](groupentry &ge) 
+    {
+        member = present && ge.grp->partofgroup(u);
+        if (member) f = ge.contentof(fn);
+    });
+    if (!found) reply(conn, "------- No such group ID: ", gid, " ------");
+    else if (!member) reply(conn, "------ Access denied. You are not part of Group ID ", gid, " -------");
+    else if (f == NOID) reply(conn, "------- No such file in group ", gid, " -------");
+    return f != NOID;
+}
+
+// file header without piece hashes
+void appendfileheader(string &out, string_view fname, FileMeta &fm) 
+{
+    put(out, "FILE ", fname, " SIZE ", fm.size, " HASH ", fm.fullhash, " PIECES ", fm.num_pieces);
+}
+
+// folding a downloader's report on peer into its good rate, reports with
+// more pieces move it further
+void notepeeroutcome(client *peer, int ok, int fail) 
+{
+    if (ok < 0 || fail < 0 || ok + fail == 0) return;
+    float share = (float)ok / (ok + fail); // this report
+    float weight = min(0.5f, (ok + fail) / 32.0f); // how far it moves the rate
+    float rate = peer->goodrate.load(memory_order_relaxed);
+    while (!peer->goodrate.compare_exchange_weak(rate, rate + weight * (share - rate), memory_order_relaxed)) {}
+}
+
+// how much of a download this seeder should get, standbys get no heartbeats
+// so every lease counts as fresh there
+double peerweight(client *peer, long long now) 
+{
+    double fresh = 1.0; // share of lease left, drops when heartbeats stop arriving
+    if (isprimary) fresh = max(0.1, (peer->leaseuntil.load(memory_order_relaxed) - now) / (LEASE_SECONDS * 1000.0));
+    double good = 0.05 + peer->goodrate.load(memory_order_relaxed); // never quite zero, a bad peer can recover
+    return good * fresh / (1 + max(0, peer->uploads.load(memory_order_relaxed)));
+}
+
+// key for weighted sampling without replacement: log(u) / weight, taking
+// the largest keys draws peers in proportion to their weight
+double samplekey(double weight) 
+{
+    static thread_local mt19937 rng(random_device{}()); // per worker, no locking
+    uniform_real_distribution<double> unit(1e-12, 1.0);
+    return log(unit(rng)) / weight;
+}
+
+// keeping the keep largest keys, largest first
+template <typename T>
+void keepbest(vector<pair<double, T>> &ranked, size_t keep) 
+{
+    keep = min(ranked.size(), keep);
+    partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(), 
+                 [](const pair<double, T> &a, const pair<double, T> &b) { return a.first > b.first; });
+    ranked.resize(keep);
+}
+
+// online seeders of file whose lease still holds, what a downloader would be handed
+size_t liveseeders(FileMeta &fm, long long now) 
+{
+    size_t live = 0; // lease held
+    for (auto &it : fm.online) 
+    {
+        if (leaselive(it.second.peer, now)) live++;
+    }
+    return live;
+}
+
+// adding online seeders of file, one per line, best first
+// walks only the online index, no user lookups. keeps at most
+// MAX_PEERS_RETURNED, drawn by weighted sampling
+void appendpeers(FileMeta &fm, string &msg) 
+{
+    long long now = nowms(); // for leases
+
+    static thread_local vector<pair<double, const pair<const nameid, seederaddr> *>> ranked; // key, seeder, reused
+    ranked.clear();
+    for (auto &it : fm.online) 
+    {
+        if (!leaselive(it.second.peer, now)) continue; // lease lapsed
+        ranked.emplace_back(samplekey(peerweight(it.second.peer, now)), &it);
+    }
+    keepbest(ranked, MAX_PEERS_RETURNED);
+    for (auto &r : ranked) 
+    {
+        put(msg, store.usernames.name(r.second->first), ' ', r.second->second.ip, ' ', r.second->second.port, '\n'); // add peer
+    }
+}
+
+// adding partial seeders of file after a PARTIAL line, one per line with
+// the pieces it has as a hex bitfield. sampled like full seeders, and
+// peers holding more of the file are more likely to be picked
+void appendpartial(FileMeta &fm, string &msg) 
+{
+    long long now = nowms(); // for leases
+
+    static thread_local vector<pair<double, const pair<const nameid, partialseeder> *>> ranked; // key, partial seeder, reused
+    ranked.clear();
+    for (auto &it : fm.partial) 
+    {
+        if (it.second.have == 0 || !leaselive(it.second.addr.peer, now)) continue;
+        double share = (double)it.second.have / max(1, fm.num_pieces); // of the file held
+        ranked.emplace_back(samplekey(peerweight(it.second.addr.peer, now) * share), &it);
+    }
+    if (ranked.empty()) return;
+    keepbest(ranked, MAX_PARTIAL_RETURNED);
+
+    msg += "PARTIAL\n";
+    for (auto &r : ranked) 
+    {
+        const partialseeder &ps = r.second->second;
+        put(msg, store.usernames.name(r.second->first), ' ', ps.addr.ip, ' ', ps.addr.port, ' ', ps.have, ' ');
+        appendhex(msg, ps.bits.data(), ps.bits.size());
+        msg += '\n';
+    }
+}
+
+// one numeric field of this process from /proc, e.g. "Threads:" or "VmRSS:" (kB)
+long long processstatus(const string &field) 
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) return 0;
+    char line[256];
+    long long value = 0;
+    string format = field + " %lld";
+    while (fgets(line, sizeof(line), fp)) 
+    {
+        if (sscanf(line, format.c_str(), &value) == 1) break;
+    }
+    fclose(fp);
+    return value;
+}
+
+// the memory estimate walks every entry under shard locks, so stats reuses
+// the last walk until it is MEASURE_SECONDS old however often it is asked
+const int MEASURE_SECONDS = 30;
+mutex measuremtx;               // one walk at a time, guards the two below
+metastore::sizes measured;      // last walk
+long long measuredat = 0;       // when, nowms, 0 for never
+
+// store sizes: entry counts as of now, the rest from a walk at most
+// MEASURE_SECONDS old. age is set to the walk's age in seconds
+metastore::sizes storesizes(long long &age) 
+{
+    metastore::sizes sz;
+    {
+        lock_guard<mutex> lock(measuremtx);
+        long long now = nowms();
+        if (measuredat == 0 || now - measuredat >= MEASURE_SECONDS * 1000LL) 
+        {
+            measured = store.measure();
+            measuredat = now;
+        }
+        sz = measured;
+        age = (now - measuredat) / 1000;
+    }
+    sz.users = store.peers.size(); // counted on insert and erase
+    sz.groups = store.groups.size();
+    sz.files = store.files.size();
+    return sz;
+}
+
+// load report for the stats command and the periodic dump
+string statsreport() 
+{
+    uint64_t opened = loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.opened; });
+    uint64_t closed = loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.closed; });
+    uint64_t streams = loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.streams; });
+    uint64_t streamsdone = loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.streamsdone; });
+    long long measureage = 0; // seconds since the memory walk
+    metastore::sizes sz = storesizes(measureage);
+
+    string msg = "STATS\n";
+    msg += "uptime_s " + to_string(loadstats.uptime()) + "\n";
+    msg += "role " + string(isprimary ? "PRIMARY " : "STANDBY ") + to_string(trackerno) + " seq " + to_string(trackerlog.lastseq()) + "\n";
+    msg += "shard " + to_string(trackershard) + " of " + to_string(ring.size()) + "\n";
+    msg += "threads workers " + to_string(workerthreads) + " total " + to_string(processstatus("Threads:")) + "\n";
+    msg += "connections active " + to_string(opened - closed) + " opened " + to_string(opened) + " standbys " + to_string(streams - streamsdone) + "\n";
+    msg += "bytes in " + to_string(loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.bytesin; })) + 
+           " out " + to_string(loadstats.total([](threadstats &t) -> atomic<uint64_t> & { return t.bytesout; })) + "\n";
+    msg += "maps peers " + to_string(sz.users) + " groups " + to_string(sz.groups) + " files " + to_string(sz.files) + 
+           " group_files " + to_string(sz.groupfiles) + " seeders " + to_string(sz.seeders) + "\n";
+    msg += "limits " + limiter.describe() + " refused " + to_string(limiter.refused.load()) + "\n";
+    msg += "events subscriptions " + to_string(notifier.subscriptions()) + " pushed " + to_string(notifier.pushed.load()) + 
+           " dropped " + to_string(notifier.dropped.load()) + "\n";
+    msg += "gc grace_s " + to_string(gcgrace.load()) + " idle " + to_string(gcidle.load()) + " reclaimed groups " + to_string(gcgroups.load()) + 
+           " files " + to_string(gcfiles.load()) + "\n";
+    msg += "memory_estimate_bytes " + to_string(sz.bytes) + " age_s " + to_string(measureage) + "\n";
+    msg += "rss_kb " + to_string(processstatus("VmRSS:")) + "\n";
+    msg += loadstats.commandlines();
+    return msg;
+}
+
+// command handlers, one per command, found through comdtable
+// comds are views into the received frame, replies go straight into the
+// connection's output buffer
+
+// login and logout remember the user for disconnect and group ownership transfer
+void trackuser(connection *conn, vector<string_view> &comds) 
+{
+    if (comds.size() > 1) conn->disconnecting_user.assign(comds[1].data(), comds[1].size()); // setting user
+}
+
+// queueing a copy of user for every other shard, sent by forwardloop
+void forwarduser(string_view user, string_view pass) 
+{
+    {
+        lock_guard<mutex> lock(forwardmtx);
+        for (int s : ring.shards()) 
+        {
+            if (s != trackershard) forwards.push_back({s, "copy_user " + string(user) + " " + string(pass)});
+        }
+    }
+    forwardcv.notify_one();
+}
+
+// create_user <username> <passcode> | copy_user <username> <passcode>
+// only the home shard takes create_user (managepeer turns the rest away),
+// and a client's registration there is copied to the other shards.
+// copy_user is that copy arriving, managepeer checked where it came from.
+// the home shard holds the user, so its copy replaces one we already have
+void createusercomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (comds[0] == "copy_user") 
+    {
+        nameid u = store.usernames.intern(comds[1]); // user
+        bool replaced = false; // had another passcode
+        if (!store.peers.insert(u, make_unique<client>(string(comds[2])))) 
+        {
+            store.peers.write(u, [&](client *peer) 
+            {
+                if (peer->passcode == comds[2]) return;
+                peer->passcode.assign(comds[2].data(), comds[2].size());
+                replaced = true;
+            });
+        }
+        if (replaced) logger.line(LOG_WARN, "------- Passcode of ID ", comds[1], " replaced by its home shard's copy -------");
+        reply(conn, "USER_COPIED ", comds[1]);
     } 
+    else 
+    {
+        if (!store.peers.insert(store.usernames.intern(comds[1]), make_unique<client>(string(comds[2])))) // add user 
+        {
+            reply(conn, "-----Cannot create user: ID already in use.-----");
+        } 
+        else 
+        {
+            reply(conn, "***** ID number ", comds[1], " registered successfully! ******");
+            logger.line(LOG_INFO, "****** ID ", comds[1], " has been registered as a new user. ******");
+            if (ring.size() > 1 && !conn->internal) forwarduser(comds[1], comds[2]); // not on replay
+        }
+    }
+}
 
-    // checking if member of a group 
-    bool partofgroup(string s) 
-    { 
-        return participants.find(s) != participants.end(); 
+// sync_user <username>, on the home shard by that user logged in here
+// copying the user to the other shards again, for a shard that never got
+// it (the primary went away before its copy went out). the copy carries
+// the passcode stored here, never one the caller sends
+void syncusercomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    string pass; // stored passcode
+    if (comds.size() != 2) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (conn->user == NOID || conn->user != userid(comds[1])) 
+    {
+        reply(conn, "------- Log in as ", comds[1], " on this connection to sync it -------");
+    } 
+    else if (ring.owner(comds[1]) != trackershard) 
+    {
+        reply(conn, "WRONG_SHARD ", ring.owner(comds[1]));
     } 
+    else if (!store.peers.read(conn->user, [&](client *c) { pass = c->passcode; })) 
+    {
+        reply(conn, "------- No such User ID: ", comds[1], " ------");
+    } 
+    else 
+    {
+        forwarduser(comds[1], pass);
+        reply(conn, "SYNCING ", comds[1], " to ", ring.size() - 1, " shards");
+    }
+}
 
-    void deluser(string s) 
+// login <username> <passcode> <ip> <port>
+void logincomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() < 5) 
+    {
+        reply(conn, "-----Invalid Arguments for login-----");
+    } 
+    else 
     {
-        participants.erase(s);  // removing user
-        if (s == groupmaster)   // cehcking if user is master 
-        { 
-            if (!participants.empty()) 
+        nameid u = userid(comds[1]); // user
+        bool loggedin = false; // passcode matched
+        bool found = store.peers.write(u, [&](client *peer) 
+        {
+            if (peer->passcode != comds[2]) 
             {
-                groupmaster = *participants.begin(); // new master
-                cout << "Group " << gid << " new owner is: " << groupmaster << endl;
+                reply(conn, "------ Authentication failed: incorrect passcode for ID ", comds[1], " ------");
             } 
             else 
             {
-                groupmaster = ""; // no master
-                cout << "Group " << gid << " has no members left" << endl;
+                loggedin = true;
+                peer->login(comds[3], comds[4]);
+                peer->session = trackerlog.lastseq() + 1; // seq this login is logged under
+                conn->session = peer->session;
+                conn->user = u;
+                renewlease(peer);
+                reply(conn, "Successful Login for User ID ", comds[1], "! ******\n");
             }
+        });
+        if (!found) reply(conn, "------ User ID ", comds[1], " is not registered ------");
+        if (loggedin) 
+        {
+            trackuser(conn, comds);
+            setonline(u, true); // seeding again
         }
     }
+}
 
-    void acceptreq(string s) 
+// logout <username>
+void logoutcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    trackuser(conn, comds);
+    if (comds.size() < 2) 
     {
-        applicants.erase(s); // removing request
-        participants.insert(s); // adding to  group
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else 
+    {
+        nameid u = userid(comds[1]); // user
+        bool found = store.peers.write(u, [&](client *peer) 
+        {
+            peer->logout(); // logout
+        });
+        setonline(u, false);
+        if (conn->user == u) conn->user = NOID;
+        if (found) reply(conn, "***** User ID ", comds[1], " logged out successfully ******");
+        else reply(conn, "------- No such User ID: ", comds[1], " ------");
     }
+}
 
-};
+// create_group <groupid> <owner_username>
+void creategroupcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() < 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!isuserpresent(userid(comds[2]))) 
+    {
+        reply(conn, "------- No such User ID: ", comds[2], " ------");
+    } 
+    else 
+    {
+        nameid owner = userid(comds[2]), g = store.groupnames.intern(comds[1]); // owner, group
+        groupentry ge;
+        ge.grp = make_unique<group>(owner); // creating new group
+        if (!store.groups.insert(g, move(ge))) // adding group 
+        {
+            reply(conn, "------- This Group ID is already taken ------");
+        } 
+        else 
+        {
+            store.peers.write(owner, [&](client *p) 
+            {
+                p->owned.insert(g);
+                p->joined.insert(g);
+            });
+            reply(conn, "******* Group creation successful. Assigned ID: ", comds[1], " *******");
+        }
+    }
+}
 
-// metadata for shared file : size, hashes, seeders
-struct FileMeta 
+// join_group <groupid> <username>
+void joingroupcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
 {
-    long long size = 0;     // size of file
-    string fullhash;        // hashing of full file
-    int num_pieces = 0;     // pieces
-    vector<string> piece_hashes;    // piece hashes
-    unordered_set<string> peers;    // who has file
-};
+    nameid u = NOID; // user
+    if (comds.size() < 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!isuserpresent(u = userid(comds[2]))) 
+    {
+        reply(conn, "------- No such User ID: ", comds[2], " ------");
+    } 
+    else if (!store.groups.write(groupid(comds[1]), [&](groupentry &ge) 
+    {
+        if (ge.grp->partofgroup(u)) 
+        {
+            reply(conn, "------- You have already joined this group: ", comds[1], " -------");
+        } 
+        else 
+        {
+            ge.grp->applicants.insert(u); // add request
+            reply(conn, "******* Request to join group ", comds[1], " has been sent ******");
+        }
+    })) 
+    {
+        reply(conn, "------- No such group ID: ", comds[1], " ------");
+    }
+}
+
+// leave_group <groupid> <username>
+void leavegroupcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid u = NOID, g = NOID; // user, group
+    if (comds.size() < 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!isuserpresent(u = userid(comds[2]))) 
+    {
+        reply(conn, "------- No such User ID: ", comds[2], " ------");
+    } 
+    else if (!store.groups.write(g = groupid(comds[1]), [&](groupentry &ge) 
+    {
+        if (!ge.grp->partofgroup(u)) 
+        {
+            reply(conn, "------ Access denied. You are not part of Group ID ", comds[1], " -------");
+        } 
+        else 
+        {
+            removemember(g, ge, u); // removing user
+            reply(conn, "****** Left group successfully. ID: ", comds[1], " ******");
+        }
+    })) 
+    {
+        reply(conn, "------- No such group ID: ", comds[1], " ------");
+    }
+}
+
+// list_requests <groupid> <owner_username>
+void listrequestscomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid u = NOID; // user
+    if (comds.size() < 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!isuserpresent(u = userid(comds[2]))) 
+    {
+        reply(conn, "------- No such User ID: ", comds[2], " ------");
+    } 
+    else if (!store.groups.read(groupid(comds[1]), [&](groupentry &ge) 
+    {
+        if (ge.grp->groupmaster != u) 
+        {
+            reply(conn, "------ Access denied. You are not the group owner of ID ", comds[1], " -------");
+        } 
+        else if (ge.grp->applicants.empty()) 
+        {
+            reply(conn, "------- Group ID ", comds[1], " has no pending join requests -------"); // no requests
+        } 
+        else 
+        {
+            size_t at = beginreply(conn);
+            for (nameid a : ge.grp->applicants) put(conn->outbuf, store.usernames.name(a), '\n'); // add requests
+            endreply(conn, at);
+        }
+    })) 
+    {
+        reply(conn, "------- No such group ID: ", comds[1], " ------");
+    }
+}
+
+// accept_request <groupid> <applicant_username> <owner_username>
+void acceptrequestcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid u = NOID; // user
+    if (comds.size() < 4) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!isuserpresent(u = userid(comds[2]))) 
+    {
+        reply(conn, "------- No such User ID: ", comds[2], " ------");
+    } 
+    else 
+    {
+        nameid owner = userid(comds[3]), g = groupid(comds[1]); // owner, group
+        bool accepted = false; // applicant is a member now
+        bool found = store.groups.write(g, [&](groupentry &ge) 
+        {
+            if (owner == NOID || ge.grp->groupmaster != owner) 
+            {
+                reply(conn, "------ Access denied. You are not the group owner of ID ", comds[1], " -------");
+            } 
+            else if (!ge.grp->isapplicant(u)) 
+            {
+                reply(conn, "------- This user (ID: ", comds[2], ") has no pending requests -------");
+            } 
+            else 
+            {
+                ge.grp->acceptreq(u); // accept
+                accepted = true;
+                reply(conn, "******* Approval granted for User ID: ", comds[2], " *******");
+            }
+        });
+        if (accepted) store.peers.write(u, [&](client *p) { p->joined.insert(g); });
+        if (!found) reply(conn, "------- No such group ID: ", comds[1], " ------");
+    }
+}
+
+// list_groups
+void listgroupscomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    size_t at = beginreply(conn);
+    put(conn->outbuf, "############### Available groups on the network ###############");
+    store.groups.readall([&](nameid g, groupentry &ge) 
+    {
+        put(conn->outbuf, '\n', store.groupnames.name(g)); // adding group
+    });
+    endreply(conn, at);
+}
+
+// upload_file <gid> <filename> <username> <size> <hash> <num_pieces> <piece_hashes...>
+void uploadfilecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() < 7) 
+    {
+        reply(conn, "-----Invalid Arguments for upload_file-----");
+    } 
+    else 
+    {
+        string_view gid = comds[1]; // group id
+        string_view fname = comds[2]; // file name
+        string_view uname = comds[3]; // user name
+        long long fsize = tonum(comds[4]); // file size
+        string_view fhash = comds[5]; // file hash
+        long long num_pieces = tonum(comds[6]); // pieces
+
+        nameid g = groupid(gid), u = userid(uname); // group, uploader
+        bool member = false; // is uploader member
+        if (fsize <= 0 || num_pieces > MAX_PIECES || num_pieces != (fsize + (long long)PIECE_SIZE - 1) / (long long)PIECE_SIZE) 
+        {
+            reply(conn, "-----Invalid size or piece count for upload_file-----"); // checked before anything is allocated
+        } 
+        else if (!isgrouppresent(g)) 
+        {
+            reply(conn, "------- No such group ID: ", gid, " ------");
+        } 
+        else if (!isuserpresent(u) || !store.groups.read(g, [&](groupentry &ge) { member = ge.grp->partofgroup(u); }) || !member) 
+        {
+            reply(conn, "------ You are not part of Group ID ", gid, " -------");
+        } 
+        else 
+        {
+            // content already known (same bytes in this or another group) keeps
+            // its piece hashes and seeders, the uploader joins them
+            nameid f = store.contents.intern(fhash); // content
+            bool known = true, conflict = false; // content seen before, with other size
+            long long mismatch = -1; // first piece whose sent hash differs from the stored one
+            size_t seeders = 0; // seeders of content before this upload
+            store.files.upsert(f, [&](FileMeta &fm) 
+            {
+                if (fm.fullhash.empty()) 
+                {
+                    known = false;
+                    fm.size = fsize; // seting size
+                    fm.fullhash = fhash; // seting hash
+                    fm.num_pieces = num_pieces; // seting pieces
+                    fm.piece_hashes.assign(num_pieces, sha1digest()); // unknown until sent
+                } 
+                else if (fm.size != fsize || fm.num_pieces != num_pieces) 
+                {
+                    conflict = true;
+                    return;
+                }
+                // sent hashes must agree with the known ones before any is taken
+                for (long long i = 0; i < num_pieces && (long long)comds.size() > 7 + i; ++i) 
+                {
+                    sha1digest d; // hash
+                    if (!fm.piece_hashes[i].empty() && hextodigest(comds[7 + i], d) && d != fm.piece_hashes[i]) 
+                    {
+                        mismatch = i;
+                        return;
+                    }
+                }
+                seeders = fm.peers.size();
+                // read piece hashes from comds[7...], known ones are kept
+                for (long long i = 0; i < num_pieces && (long long)comds.size() > 7 + i; ++i) 
+                {
+                    sha1digest d; // hash
+                    if (fm.piece_hashes[i].empty() && hextodigest(comds[7 + i], d)) fm.piece_hashes[i] = d; // adding hash
+                }
+            });
+            if (conflict) 
+            {
+                reply(conn, "------- Content hash ", fhash, " is already registered with a different size -------");
+            } 
+            else if (mismatch >= 0) 
+            {
+                reply(conn, "------- Content hash ", fhash, " is already registered with a different hash for piece ", mismatch, " -------");
+            } 
+            else 
+            {
+                addseeder(f, u); // uploader seeds it
+                nameid fn = store.filenames.intern(fname); // name in the group
+                nameid old = NOID; // content the name stood for before
+                store.groups.write(g, [&](groupentry &ge) 
+                {
+                    old = ge.addfile(fn, f, store.filenames); // adding file
+                });
+                if (old != f) 
+                {
+                    store.files.write(old, [&](FileMeta &fm) { fm.unlist(g, fn); });
+                    store.files.write(f, [&](FileMeta &fm) { fm.listed.push_back({g, fn}); });
+                }
+                store.search.add(fn, fname, g);
+                notifier.publish(topicof(TOPIC_GROUP, g), "FILE_UPLOADED ", gid, ' ', fname, ' ', fsize, ' ', uname);
+
+                reply(conn, "******* File ", fname, " uploaded to group ", gid, " successfully *******");
+                if (known) logger.line(LOG_INFO, "Tracker: Registered file ", fname, " size ", fsize, " pieces ", num_pieces, " (same content as an earlier upload, ", seeders, " seeders)");
+                else logger.line(LOG_INFO, "Tracker: Registered file ", fname, " size ", fsize, " pieces ", num_pieces);
+            }
+        }
+    }
+}
+
+// list_files <gid> <username> [prefix=<p>] [minsize=<n>] [maxsize=<n>] [minseeders=<n>] [limit=<n>] [after=<name>]
+// one page of the group's files in name order, a page with more after it
+// ends with "NEXT <name>", which is passed back as after= for the next one.
+// a page lists at most limit files and looks at most MAX_LIST_SCAN, so
+// reply size and time stay bounded however big the group and however
+// selective the filters
+void listfilescomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    string_view prefix, after; // name filter, cursor
+    long long minsize = 0, maxsize = LLONG_MAX; // size filter
+    size_t minseeders = 0, limit = MAX_LIST_PAGE; // online seeders filter, page size
+    bool valid = comds.size() >= 3; // arguments understood
+    for (size_t i = 3; i < comds.size() && valid; i++) 
+    {
+        string_view opt, val; // option and its value
+        if (!splitoption(comds[i], opt, val)) valid = false;
+        else if (opt == "prefix") prefix = val;
+        else if (opt == "after") after = val;
+        else if (opt == "minsize") minsize = tonum(val);
+        else if (opt == "maxsize") maxsize = tonum(val);
+        else if (opt == "minseeders") minseeders = max(0LL, tonum(val));
+        else if (opt == "limit") limit = min((size_t)max(1LL, tonum(val)), MAX_LIST_PAGE);
+        else valid = false;
+    }
+
+    if (!valid) 
+    {
+        reply(conn, "-----Invalid Arguments for list_files-----");
+    } 
+    else 
+    {
+        string_view gid = comds[1]; // group id
+        nameid u = userid(comds[2]); // user
+        bool present = isuserpresent(u); // is user registered
+        bool found = store.groups.read(groupid(gid), [&](groupentry &ge) 
+        {
+            if (!present || !ge.grp->partofgroup(u)) 
+            {
+                reply(conn, "------ Access denied. You are not part of Group ID ", gid, " -------");
+            } 
+            else if (ge.files.empty()) 
+            {
+                reply(conn, "------- No files uploaded in group ", gid, " -------"); // no files
+            } 
+            else 
+            {
+                size_t at = beginreply(conn);
+                if (after.empty()) put(conn->outbuf, "######## Files in Group ", gid, " ########\n");
+                auto it = ge.byname.lower_bound(prefix); // first name with prefix
+                if (!after.empty() && after >= prefix) it = ge.byname.upper_bound(after);
+                size_t listed = 0, scanned = 0; // files in page, names looked at
+                string_view last; // last name looked at
+                long long now = nowms(); // for leases
+                for (; it != ge.byname.end() && it->first.substr(0, prefix.size()) == prefix; ++it) 
+                {
+                    if (listed == limit || scanned == MAX_LIST_SCAN) 
+                    {
+                        put(conn->outbuf, "NEXT ", last, '\n'); // more after this page
+                        break;
+                    }
+                    scanned++;
+                    last = it->first;
+                    store.files.read(ge.contentof(it->second), [&](FileMeta &fm) 
+                    {
+                        if (fm.size < minsize || fm.size > maxsize) return;
+                        size_t seeders = liveseeders(fm, now); // lease held
+                        if (seeders < minseeders) return;
+                        put(conn->outbuf, it->first, " SIZE:", fm.size, " PIECES:", fm.num_pieces, " SEEDERS:", seeders, '\n'); // adding file
+                        listed++;
+                    });
+                }
+                endreply(conn, at);
+            }
+        });
+        if (!found) reply(conn, "------- No such group ID: ", gid, " ------");
+    }
+}
+
+// search_files <username> <query> [minseeders=<n>] [limit=<n>] [after=<name> [aftergroup=<gid>]]
+// files whose name contains query (any case, at least 3 characters) in every
+// group the user is a member of, as "<group> <name> SIZE:<size> PIECES:<n>
+// SEEDERS:<online>" lines. paged like list_files, a page with more after it
+// ends with "NEXT <name>", or "NEXT <name> <gid>" when the page was cut among
+// the groups of one name (passed back as after= and aftergroup=)
+void searchfilescomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    string_view after, aftergroup; // cursor, name and group of the last row
+    size_t minseeders = 0, limit = MAX_LIST_PAGE; // online seeders filter, page size
+    bool valid = comds.size() >= 3; // arguments understood
+    for (size_t i = 3; i < comds.size() && valid; i++) 
+    {
+        string_view opt, val; // option and its value
+        if (!splitoption(comds[i], opt, val)) valid = false;
+        else if (opt == "after") after = val;
+        else if (opt == "aftergroup") aftergroup = val;
+        else if (opt == "minseeders") minseeders = max(0LL, tonum(val));
+        else if (opt == "limit") limit = min((size_t)max(1LL, tonum(val)), MAX_LIST_PAGE);
+        else valid = false;
+    }
+    nameid from = NOID; // cursor
+    nameid fromgroup = aftergroup.empty() ? NOID : groupid(aftergroup); // NOID if reclaimed since, its name starts over
+    static thread_local vector<nameid> joined; // groups the user is a member of, sorted
+    joined.clear();
+    if (!valid || (!after.empty() && (from = fileid(after)) == NOID) || (!aftergroup.empty() && after.empty())) 
+    {
+        reply(conn, "-----Invalid Arguments for search_files-----");
+    } 
+    else if (!store.peers.read(userid(comds[1]), [&](client *p) { joined = p->joined.ids; })) 
+    {
+        reply(conn, "------- No such User ID: ", comds[1], " ------");
+    } 
+    else if (comds[2].size() < searchindex::MIN_QUERY) 
+    {
+        reply(conn, "-----Search needs at least ", searchindex::MIN_QUERY, " characters-----");
+    } 
+    else 
+    {
+        size_t listed = 0; // lines in page
+        nameid lastname = NOID, lastgroup = NOID; // row the page ends on
+        bool full = false; // another row did not fit
+        long long now = nowms(); // for leases
+        size_t at = beginreply(conn);
+        if (after.empty()) put(conn->outbuf, "######## Files matching ", comds[2], " ########\n");
+        nameid stop = store.search.match(comds[2], store.filenames, from, MAX_SEARCH_SCAN, [&](nameid fname, const vector<nameid> &gs) 
+        {
+            for (nameid g : gs) 
+            {
+                if (fname == from && fromgroup != NOID && g <= fromgroup) continue; // on the last page
+                if (!binary_search(joined.begin(), joined.end(), g)) continue; // not a member
+                nameid content = NOID; // behind the name in g
+                store.groups.read(g, [&](groupentry &ge) { content = ge.contentof(fname); });
+                store.files.read(content, [&](FileMeta &fm) 
+                {
+                    size_t seeders = liveseeders(fm, now); // lease held
+                    if (seeders < minseeders) return;
+                    if (listed == limit) 
+                    {
+                        full = true;
+                        return;
+                    }
+                    put(conn->outbuf, store.groupnames.name(g), ' ', store.filenames.name(fname), " SIZE:", fm.size, 
+                        " PIECES:", fm.num_pieces, " SEEDERS:", seeders, '\n'); // adding match
+                    listed++;
+                    lastname = fname;
+                    lastgroup = g;
+                });
+                if (full) return false;
+            }
+            return true;
+        }, !aftergroup.empty());
+        if (full) put(conn->outbuf, "NEXT ", store.filenames.name(lastname), ' ', store.groupnames.name(lastgroup), '\n'); // cut at the last row
+        else if (stop != NOID) put(conn->outbuf, "NEXT ", store.filenames.name(stop), '\n'); // scan limit, more after this page
+        endreply(conn, at);
+    }
+}
+
+// download_file <gid> <filename> <username>
+// file metadata with every piece hash and list of seeders
+void downloadfilecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid f, u; // file, user
+    if (comds.size() < 4) 
+    {
+        reply(conn, "-----Invalid Arguments for download_file-----");
+    } 
+    else if (canaccessfile(conn, comds[1], comds[2], comds[3], f, u)) 
+    {
+        bool found = store.files.read(f, [&](FileMeta &fm) 
+        {
+            size_t at = beginreply(conn);
+            string &out = conn->outbuf; // reply is built in place
+            out.reserve(out.size() + fm.piece_hashes.size() * (2 * DIGEST_SIZE + 1) + 256);
+            appendfileheader(out, comds[2], fm);
+            put(out, " PIECE_HASHES");
+            for (auto &h : fm.piece_hashes) 
+            {
+                out.push_back(' ');
+                appendhex(out, h.b, DIGEST_SIZE); // adding hashes
+            }
+            put(out, "\nPEERS\n");
+            appendpeers(fm, out);
+            appendpartial(fm, out);
+            out.push_back('\n');
+            endreply(conn, at);
+        });
+        if (!found) reply(conn, "------- No such file in group ", comds[1], " -------");
+    }
+}
+
+// file_info <gid> <filename> <username>
+// file header and seeders only, piece hashes are fetched in ranges
+void fileinfocomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid f, u; // file, user
+    if (comds.size() < 4) 
+    {
+        reply(conn, "-----Invalid Arguments for file_info-----");
+    } 
+    else if (canaccessfile(conn, comds[1], comds[2], comds[3], f, u)) 
+    {
+        bool found = store.files.read(f, [&](FileMeta &fm) 
+        {
+            size_t at = beginreply(conn);
+            appendfileheader(conn->outbuf, comds[2], fm);
+            put(conn->outbuf, "\nPEERS\n");
+            appendpeers(fm, conn->outbuf);
+            appendpartial(fm, conn->outbuf);
+            conn->outbuf.push_back('\n');
+            endreply(conn, at);
+        });
+        if (!found) reply(conn, "------- No such file in group ", comds[1], " -------");
+    }
+}
+
+// get_piece_hashes <gid> <filename> <username> <start> <count>
+// replies "HASHES <start> <count>\n" then count raw 20-byte digests, count capped at MAX_HASH_RANGE
+void getpiecehashescomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid f, u; // file, user
+    if (comds.size() != 6) 
+    {
+        reply(conn, "-----Invalid Arguments for get_piece_hashes-----");
+    } 
+    else if (canaccessfile(conn, comds[1], comds[2], comds[3], f, u)) 
+    {
+        long long start = tonum(comds[4]); // first piece
+        long long count = tonum(comds[5]); // pieces asked
+        bool found = store.files.read(f, [&](FileMeta &fm) 
+        {
+            long long total = fm.piece_hashes.size(); // hashes known
+            if (start < 0 || start >= total || count <= 0) 
+            {
+                reply(conn, "-----Invalid piece range-----");
+                return;
+            }
+            if (count > MAX_HASH_RANGE) count = MAX_HASH_RANGE;
+            if (start + count > total) count = total - start;
+
+            size_t at = beginreply(conn);
+            put(conn->outbuf, "HASHES ", start, ' ', count, '\n');
+            conn->outbuf.append((const char *)fm.piece_hashes[start].b, count * DIGEST_SIZE); // adding hashes
+            endreply(conn, at);
+        });
+        if (!found) reply(conn, "------- No such file in group ", comds[1], " -------");
+    }
+}
+
+// add_piece_hashes <gid> <filename> <username> <start>\n<raw 20-byte digests>
+// uploader sends piece hashes in chunks after upload_file
+void addpiecehashescomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid f, u; // file, user
+    if (comds.size() != 5 || bloblen == 0 || bloblen % DIGEST_SIZE != 0) 
+    {
+        reply(conn, "-----Invalid Arguments for add_piece_hashes-----");
+    } 
+    else if (canaccessfile(conn, comds[1], comds[2], comds[3], f, u)) 
+    {
+        string_view fname = comds[2]; // file name
+        long long start = tonum(comds[4]); // first piece
+        long long count = bloblen / DIGEST_SIZE; // hashes sent
+        bool found = store.files.write(f, [&](FileMeta &fm) 
+        {
+            if (!fm.peers.contains(u)) 
+            {
+                reply(conn, "------ Only seeders of ", fname, " can add piece hashes -------");
+            } 
+            else if (start < 0 || start + count > (long long)fm.piece_hashes.size()) 
+            {
+                reply(conn, "-----Invalid piece range-----");
+            } 
+            else 
+            {
+                // only unknown slots are filled, hashes of shared content are never rewritten
+                const sha1digest *in = (const sha1digest *)blob; // sent hashes
+                long long mismatch = -1; // first piece whose sent hash differs from the stored one
+                for (long long i = 0; i < count && mismatch < 0; i++) 
+                {
+                    if (!fm.piece_hashes[start + i].empty() && fm.piece_hashes[start + i] != in[i]) mismatch = start + i;
+                }
+                if (mismatch >= 0) 
+                {
+                    reply(conn, "------- Piece ", mismatch, " of ", fname, " already has a different hash -------");
+                    return;
+                }
+                for (long long i = 0; i < count; i++) 
+                {
+                    if (fm.piece_hashes[start + i].empty()) fm.piece_hashes[start + i] = in[i]; // seting hash
+                }
+                reply(conn, "SUCCESS: ", count, " piece hashes stored for ", fname, " from ", start);
+            }
+        });
+        if (!found) reply(conn, "------- No such file in group ", comds[1], " -------");
+    }
+}
+
+// file_downloaded <gid> <filename> <peername>
+// will notify tracker that peer completed download and can now serve file
+void filedownloadedcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 4) 
+    {
+        reply(conn, "-----Invalid Arguments for file_downloaded-----");
+    } 
+    else 
+    {
+        string_view filename = comds[2]; // file name
+        string_view peername = comds[3]; // peer name
+
+        nameid f = NOID, u = userid(peername); // content, peer
+        bool member = false, hasfile = false; // checks on group
+        store.groups.read(groupid(comds[1]), [&](groupentry &ge) 
+        {
+            member = ge.grp->partofgroup(u);
+            f = ge.contentof(fileid(filename));
+            hasfile = f != NOID;
+        });
+
+        if (!member) reply(conn, "ERROR: Group not found or peer not member");
+        else if (!hasfile) reply(conn, "ERROR: File not found in group");
+        else if (!isuserpresent(u)) reply(conn, "ERROR: Peer not found");
+        else 
+        {
+            addseeder(f, u); // adding peer
+            reply(conn, "SUCCESS: Peer ", peername, " registered as seeder for ", filename);
+        }
+    }
+}
+
+// have_pieces <gid> <filename> <username> <piece> [<piece> ...]
+// downloader announcing the pieces it got since its last announce, it is
+// handed out as a partial seeder until it has the whole file or goes offline
+void havepiecescomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    nameid f, u; // file, downloader
+    if (comds.size() < 5) 
+    {
+        reply(conn, "-----Invalid Arguments for have_pieces-----");
+    } 
+    else if (canaccessfile(conn, comds[1], comds[2], comds[3], f, u)) 
+    {
+        bool online = false; // only online peers can serve
+        seederaddr addr; // where it can be reached
+        store.peers.write(u, [&](client *p) 
+        {
+            online = p->connected;
+            if (online) p->partialfiles.insert(f);
+            addr = seederaddr{p, p->hostip, p->hostport};
+        });
+        if (!online || !store.files.write(f, [&](FileMeta &fm) 
+        {
+            if (fm.peers.contains(u)) // already a full seeder 
+            {
+                reply(conn, "PIECES_NOTED ", fm.num_pieces, ' ', fm.num_pieces);
+                return;
+            }
+            partialseeder &ps = fm.partial[u];
+            ps.addr = addr;
+            ps.bits.resize((fm.num_pieces + 7) / 8);
+            for (size_t i = 4; i < comds.size(); i++) 
+            {
+                long long piece = tonum(comds[i]);
+                if (piece >= 0 && piece < fm.num_pieces) ps.setpiece(piece);
+            }
+            reply(conn, "PIECES_NOTED ", ps.have, ' ', fm.num_pieces);
+        })) 
+        {
+            reply(conn, "NOT_LOGGED_IN");
+        }
+    }
+}
+
+// stop_share <gid> <filename> <peername>
+// removing peer from the seeders of the file's content, in every group holding it
+void stopsharecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 4) 
+    {
+        reply(conn, "-----Invalid Arguments for stop_share-----");
+    } else {
+        string_view gid = comds[1]; // group id
+        string_view filename = comds[2]; // file name
+        string_view peername = comds[3]; // peer name
+
+        nameid f = NOID, u = userid(peername); // content, peer
+        bool present = isuserpresent(u); // is user registered
+        bool member = false, hasfile = false; // checks on group
+        bool wasonline = false; // subscribers hear it went away
+        bool found = store.groups.read(groupid(gid), [&](groupentry &ge) 
+        {
+            member = ge.grp->partofgroup(u);
+            f = ge.contentof(fileid(filename));
+            hasfile = f != NOID;
+        });
+
+        if (!found) 
+        {
+            reply(conn, "ERROR: Group not found");
+        } 
+        else if (!present || !member) 
+        {
+            reply(conn, "ERROR: Peer not found or not member of group");
+        } 
+        else if (!hasfile) 
+        {
+            reply(conn, "ERROR: File not found in group");
+        } 
+        else if (!store.files.write(f, [&](FileMeta &fm) { fm.peers.erase(u); wasonline = fm.online.erase(u) > 0; fm.partial.erase(u); })) // removing peer 
+        {
+            reply(conn, "ERROR: File metadata not found");
+        } 
+        else 
+        {
+            store.peers.write(u, [&](client *p) 
+            {
+                p->files.erase(f); // removing file
+                p->partialfiles.erase(f);
+            });
+            if (wasonline) seederevent(f, u, NULL);
+            reply(conn, "SUCCESS: Peer ", peername, " stopped sharing ", filename, " in group ", gid);
+        }
+    }
+}
+
+// peer_disconnected <username> [session], internal
+// connection of user closed: offline unless it has logged in again since,
+// and then handing over groups it owns, found through its owned index so a
+// disconnect costs the user's own groups, not every group. a stale session
+// (logged in again elsewhere) keeps its groups
+void peerdisconnectedcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() < 2) 
+    {
+        reply(conn, "Unrecognized command");
+        return;
+    }
+    uint64_t session = comds.size() > 2 ? tounum(comds[2]) : 0; // 0: older record
+    bool ended = false; // session logged out
+    vector<nameid> owned; // groups user is master of
+    nameid u = userid(comds[1]); // user
+    store.peers.write(u, [&](client *peer) 
+    {
+        ended = session && peer->connected && peer->session == session;
+        if (ended) 
+        {
+            peer->logout();
+            owned = peer->owned.ids;
+        }
+    });
+    if (!ended) return;
+    setonline(u, false);
+    for (nameid g : owned) 
+    {
+        store.groups.write(g, [&](groupentry &ge) 
+        {
+            if (ge.grp->groupmaster == u) removemember(g, ge, u); // removing master
+        });
+    }
+}
+
+// tracker_restarted, internal
+// every connection died with the old process, so nobody is online
+void trackerrestartedcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    store.peers.writeall([&](nameid u, client *peer) 
+    {
+        peer->logout(); // logout
+        peer->partialfiles.clear();
+    });
+    store.files.writeall([&](nameid f, FileMeta &fm) 
+    {
+        fm.online.clear(); // nobody is seeding
+        fm.partial.clear();
+    });
+}
+
+// tracker_promoted <epoch>, internal
+// start of a new primary term, standbys learn it from the log
+void trackerpromotedcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 2) reply(conn, "Unrecognized command");
+    else trackerepoch = tounum(comds[1]);
+}
+
+// lease_expired <username> <session>, internal
+// seeder stopped heartbeating, taking it offline
+void leaseexpiredcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 3) 
+    {
+        reply(conn, "Unrecognized command");
+        return;
+    }
+    uint64_t session = tounum(comds[2]);
+    bool expired = false; // still expired and same session
+    nameid u = userid(comds[1]); // user
+    store.peers.write(u, [&](client *peer) 
+    {
+        // the primary rechecks, the lease may have been renewed since the reaper looked
+        bool lapsed = !isprimary || conn->replaying || peer->leaseuntil.load() <= nowms();
+        expired = peer->connected && peer->session == session && lapsed;
+        if (expired) peer->logout();
+    });
+    if (expired) 
+    {
+        setonline(u, false);
+        logger.line(LOG_WARN, "------- Lease of ", comds[1], " expired, marked offline -------");
+    } 
+    else comds[2] = "0"; // logged as a no-op so standbys do the same
+}
+
+// reclaim group <gid> | reclaim file <hash>, internal
+// dropping a group nobody is left in, with its file names, or a content
+// nobody seeds or no group lists any more, with every group file name
+// standing for it and its place in its holders' file lists. subscriptions
+// to it end, and its name and the file names no group lists any more are
+// released for reuse
+void reclaimcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 3) 
+    {
+        reply(conn, "Unrecognized command");
+        return;
+    }
+    // the primary rechecks, the entry may have come back to life since the reaper looked
+    bool recheck = isprimary && !conn->replaying;
+    if (comds[1] == "group") 
+    {
+        nameid g = groupid(comds[2]); // group
+        vector<pair<nameid, nameid>> names; // file name, content
+        bool idle = false; // no members
+        store.groups.read(g, [&](groupentry &ge) 
+        {
+            idle = !recheck || ge.grp->participants.empty();
+            if (idle) names.assign(ge.files.begin(), ge.files.end());
+        });
+        if (!idle || !store.groups.erase(g)) 
+        {
+            comds[1] = "none"; // logged as a no-op so standbys do the same
+            return;
+        }
+        for (auto &n : names) 
+        {
+            if (store.search.remove(n.first, store.filenames.name(n.first), g)) store.filenames.release(n.first);
+            store.files.write(n.second, [&](FileMeta &fm) { fm.unlist(g, n.first); });
+        }
+        notifier.droptopic(topicof(TOPIC_GROUP, g));
+        store.groupnames.release(g);
+        gcgroups.fetch_add(1, memory_order_relaxed);
+        logger.line(LOG_INFO, "Group ", comds[2], " reclaimed with ", names.size(), " files");
+    } 
+    else if (comds[1] == "file") 
+    {
+        nameid f = store.contents.find(comds[2]); // content
+        vector<pair<nameid, nameid>> listed; // group, file name
+        vector<nameid> holders; // full and partial seeders
+        bool idle = false; // nothing to hand out
+        store.files.read(f, [&](FileMeta &fm) 
+        {
+            idle = !recheck || fm.idle();
+            if (!idle) return;
+            listed = fm.listed;
+            holders = fm.peers.ids;
+            for (auto &it : fm.partial) holders.push_back(it.first);
+        });
+        if (!idle || !store.files.erase(f)) 
+        {
+            comds[1] = "none";
+            return;
+        }
+        for (auto &gn : listed) 
+        {
+            store.groups.write(gn.first, [&](groupentry &ge) { ge.removefile(gn.second, store.filenames); });
+            if (store.search.remove(gn.second, store.filenames.name(gn.second), gn.first)) store.filenames.release(gn.second);
+        }
+        for (nameid u : holders) 
+        {
+            store.peers.write(u, [&](client *p) 
+            {
+                p->files.erase(f);
+                p->partialfiles.erase(f);
+            });
+        }
+        notifier.droptopic(topicof(TOPIC_FILE, f));
+        store.contents.release(f);
+        gcfiles.fetch_add(1, memory_order_relaxed);
+        logger.line(LOG_INFO, "Content ", comds[2], " reclaimed from ", listed.size(), " group file names");
+    }
+}
+
+// heartbeat <username> [active_uploads], renewing the seeder lease
+void heartbeatcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    bool renewed = false; // lease lapsed or unknown user, client logs in again
+    if (comds.size() == 2 || comds.size() == 3) 
+    {
+        store.peers.read(userid(comds[1]), [&](client *peer) 
+        {
+            if (!peer->connected) return;
+            renewlease(peer);
+            if (comds.size() == 3) peer->uploads.store((int)tonum(comds[2]), memory_order_relaxed); // for ranking
+            renewed = true;
+        });
+    }
+    if (renewed) reply(conn, "HEARTBEAT_OK ", LEASE_SECONDS);
+    else reply(conn, "NOT_LOGGED_IN");
+}
+
+// report_peers <username> <peer> <ok> <fail> [<peer> <ok> <fail> ...]
+// pieces a download got from each peer, feeding peer ranking. soft state
+// like leases, not logged
+void reportpeerscomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    bool online = false; // only logged in users report
+    if (comds.size() >= 2) store.peers.read(userid(comds[1]), [&](client *peer) { online = peer->connected; });
+    if (comds.size() < 5 || (comds.size() - 2) % 3 != 0) reply(conn, "-----Invalid Arguments for report_peers-----");
+    else if (!online) reply(conn, "NOT_LOGGED_IN");
+    else 
+    {
+        int noted = 0; // peers found
+        for (size_t i = 2; i + 2 < comds.size(); i += 3) 
+        {
+            if (comds[i] == comds[1]) continue; // not rating itself
+            store.peers.read(userid(comds[i]), [&](client *peer) 
+            {
+                notepeeroutcome(peer, (int)tonum(comds[i + 1]), (int)tonum(comds[i + 2]));
+                noted++;
+            });
+        }
+        reply(conn, "REPORTED ", noted);
+    }
+}
+
+// topic named by "<username> file <gid> <filename>" or "<username> group <gid>"
+// subscribing needs what reading needs (membership), unsubscribing does not,
+// so a user who left a group can still stop its events. errors are replied here
+bool subscriptiontopic(connection *conn, vector<string_view> &comds, bool check, uint64_t &t) 
+{
+    nameid f = NOID, u = NOID; // content, user
+    if (comds.size() == 5 && comds[2] == "file") 
+    {
+        if (check) 
+        {
+            if (!canaccessfile(conn, comds[3], comds[4], comds[1], f, u)) return false;
+        } 
+        else if (!store.groups.read(groupid(comds[3]), [&](groupentry &ge) { f = ge.contentof(fileid(comds[4])); }) || f == NOID) 
+        {
+            reply(conn, "------- No such file in group ", comds[3], " -------");
+            return false;
+        }
+        t = topicof(TOPIC_FILE, f);
+        return true;
+    }
+    if (comds.size() == 4 && comds[2] == "group") 
+    {
+        nameid g = groupid(comds[3]); // group
+        bool member = false; // user in group
+        u = userid(comds[1]);
+        if (!store.groups.read(g, [&](groupentry &ge) { member = u != NOID && ge.grp->partofgroup(u); })) 
+        {
+            reply(conn, "------- No such group ID: ", comds[3], " ------");
+            return false;
+        }
+        if (check && !member) 
+        {
+            reply(conn, "------ Access denied. You are not part of Group ID ", comds[3], " -------");
+            return false;
+        }
+        t = topicof(TOPIC_GROUP, g);
+        return true;
+    }
+    reply(conn, "-----Invalid Arguments for ", comds[0], "-----");
+    return false;
+}
+
+// subscribe <username> file <gid> <filename> | subscribe <username> group <gid>
+// from now on this connection gets FRAME_EVENTs: "SEEDER_JOINED <hash> <user>
+// <ip> <port>" and "SEEDER_LEFT <hash> <user>" for the file's content,
+// "FILE_UPLOADED <gid> <filename> <size> <user>" for the group. they stop
+// when it unsubscribes or closes. soft state like leases, not logged.
+// only the user logged in on this connection can subscribe, so naming
+// another member cannot read a group's events
+void subscribecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    uint64_t t; // topic
+    if (comds.size() > 1 && (conn->user == NOID || conn->user != userid(comds[1]))) 
+    {
+        reply(conn, "------- Log in as ", comds[1], " on this connection to subscribe -------");
+        return;
+    }
+    if (!subscriptiontopic(conn, comds, true, t)) return;
+    if (!notifier.subscribe(&conn->push, t)) reply(conn, "------- Too many subscriptions on this connection (at most ", MAX_SUBSCRIPTIONS, ") -------");
+    else if (comds[2] == "file") reply(conn, "SUBSCRIBED FILE ", store.contents.name((nameid)t));
+    else reply(conn, "SUBSCRIBED GROUP ", comds[3]);
+}
+
+// unsubscribe <username> file <gid> <filename> | unsubscribe <username> group <gid>
+void unsubscribecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    uint64_t t; // topic
+    if (!subscriptiontopic(conn, comds, false, t)) return;
+    if (notifier.unsubscribe(&conn->push, t)) reply(conn, "UNSUBSCRIBED");
+    else reply(conn, "------- Not subscribed to that ", comds[2], " -------");
+}
+
+// stats, load report: command counts and latency percentiles, connections,
+// threads, traffic and metadata sizes
+void statscomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    reply(conn, statsreport());
+}
+
+// tracker_role, which tracker to send mutations to
+void trackerrolecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (isprimary) reply(conn, "ROLE PRIMARY ", trackerno);
+    else reply(conn, "ROLE STANDBY ", trackerno, ' ', primaryno.load());
+}
+
+// comparing without stopping at the first difference, so reply times say nothing about the secret
+bool samesecret(string_view given, const string &secret) 
+{
+    if (given.size() != secret.size()) return false;
+    unsigned char diff = 0; // bits that differ
+    for (size_t i = 0; i < secret.size(); i++) diff |= given[i] ^ secret[i];
+    return diff == 0;
+}
+
+// tracker_auth <shard> <secret>, another tracker proving it is one of ours
+// a lone tracker has no secret and takes nobody
+void trackerauthcomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    int shard = comds.size() == 3 ? (int)tonum(comds[1]) : 0; // claimed shard
+    const vector<int> &shards = ring.shards();
+    if (comds.size() != 3) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (trackersecret.empty() || !samesecret(comds[2], trackersecret) || !binary_search(shards.begin(), shards.end(), shard)) 
+    {
+        logger.line(LOG_WARN, "------- Tracker authentication failed on socket ", conn->fd, " -------");
+        reply(conn, "------- Tracker authentication failed -------");
+    } 
+    else 
+    {
+        conn->peershard = shard;
+        reply(conn, "AUTHENTICATED ", trackershard);
+    }
+}
+
+// connection comes from a tracker of shard: it has the secret, and its address
+// is one of that shard's in tracker_info.txt
+bool fromshard(connection *conn, int shard) 
+{
+    if (conn->peershard != shard) return false;
+    struct sockaddr_in peer; // other end
+    socklen_t len = sizeof(peer);
+    char ip[INET_ADDRSTRLEN]; // its address
+    if (getpeername(conn->fd, (struct sockaddr *)&peer, &len) < 0 || !inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip))) return false;
+    for (auto &a : alltrackers) 
+    {
+        if (a.shard == shard && a.ip == ip) return true;
+    }
+    return false;
+}
+
+// replicate <tracker_no> <epoch> <last seq>, standby asking for the log stream
+// only the other trackers of our shard get it, and only so many at once
+void replicatecomd(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen) 
+{
+    if (comds.size() != 4 || tonum(comds[1]) <= 0 || tonum(comds[1]) > (long long)trackeraddrs.size() || tonum(comds[1]) == trackerno) 
+    {
+        reply(conn, "-----Invalid Arguments-----");
+    } 
+    else if (!fromshard(conn, trackershard)) 
+    {
+        reply(conn, "------- Log is streamed only to the trackers of shard ", trackershard, " -------");
+    } 
+    else if (!isprimary) 
+    {
+        reply(conn, "NOT_PRIMARY ", primaryno.load());
+    } 
+    else if (standbystreams.fetch_add(1) >= MAX_STANDBY_STREAMS) 
+    {
+        standbystreams--;
+        reply(conn, "------- Already streaming to ", MAX_STANDBY_STREAMS, " standbys -------");
+    } 
+    else 
+    {
+        conn->standbyno = (int)tonum(comds[1]); // streamed by shiplog
+        conn->standbyepoch = tounum(comds[2]);
+        conn->standbyseq = tounum(comds[3]);
+    }
+}
+
+typedef void (*comdhandler)(connection *conn, vector<string_view> &comds, const char *blob, size_t bloblen);
+
+// how a command runs: its handler, whether it changes tracker state (and so
+// goes through the write-ahead log), whether only the tracker may send it and
+// which token names the group, whose shard has to be us (0 for none)
+struct comdentry 
+{
+    comdhandler run;
+    bool mutating;
+    bool internal;
+    size_t grouparg;
+};
+
+// dispatch table, looked up with the command token straight off the frame
+const unordered_map<string_view, comdentry> comdtable = {
+    {"create_user",       {createusercomd, true, false, 0}},
+    {"copy_user",         {createusercomd, true, false, 0}},
+    {"sync_user",         {syncusercomd, false, false, 0}},
+    {"login",             {logincomd, true, false, 0}},
+    {"logout",            {logoutcomd, true, false, 0}},
+    {"create_group",      {creategroupcomd, true, false, 1}},
+    {"join_group",        {joingroupcomd, true, false, 1}},
+    {"leave_group",       {leavegroupcomd, true, false, 1}},
+    {"list_requests",     {listrequestscomd, false, false, 1}},
+    {"accept_request",    {acceptrequestcomd, true, false, 1}},
+    {"list_groups",       {listgroupscomd, false, false, 0}},
+    {"upload_file",       {uploadfilecomd, true, false, 1}},
+    {"list_files",        {listfilescomd, false, false, 1}},
+    {"search_files",      {searchfilescomd, false, false, 0}},
+    {"download_file",     {downloadfilecomd, false, false, 1}},
+    {"file_info",         {fileinfocomd, false, false, 1}},
+    {"get_piece_hashes",  {getpiecehashescomd, false, false, 1}},
+    {"add_piece_hashes",  {addpiecehashescomd, true, false, 1}},
+    {"file_downloaded",   {filedownloadedcomd, true, false, 1}},
+    {"have_pieces",       {havepiecescomd, true, false, 1}},
+    {"stop_share",        {stopsharecomd, true, false, 1}},
+    {"peer_disconnected", {peerdisconnectedcomd, true, true, 0}},
+    {"tracker_restarted", {trackerrestartedcomd, true, true, 0}},
+    {"tracker_promoted",  {trackerpromotedcomd, true, true, 0}},
+    {"lease_expired",     {leaseexpiredcomd, true, true, 0}},
+    {"reclaim",           {reclaimcomd, true, true, 0}},
+    {"heartbeat",         {heartbeatcomd, false, false, 0}},
+    {"report_peers",      {reportpeerscomd, false, false, 0}},
+    {"subscribe",         {subscribecomd, false, false, 3}},
+    {"unsubscribe",       {unsubscribecomd, false, false, 3}},
+    {"stats",             {statscomd, false, false, 0}},
+    {"tracker_role",      {trackerrolecomd, false, false, 0}},
+    {"replicate",         {replicatecomd, false, false, 0}},
+    {"tracker_auth",      {trackerauthcomd, false, false, 0}},
+};
+
+// for handling one command from connected client
+// text command is the first line, anything after the first newline is a binary blob
+// tokens are views into comd, which has to stay put until this returns
+void managepeer(connection *conn, string_view comd) 
+{
+    const char *blob = NULL; // binary payload
+    size_t bloblen = 0; // payload size
+    size_t nl = comd.find('\n');
+    if (nl != string_view::npos) 
+    {
+        blob = comd.data() + nl + 1;
+        bloblen = comd.size() - nl - 1;
+        comd = comd.substr(0, nl); // command line
+    }
+
+    if (!conn->replaying && comd.compare(0, 13, "tracker_auth ") != 0) logger.command("Incoming command from socket ", conn->fd, ": ", comd); // sampled and rate limited, never the secret
+
+    // tokenize command string into args, token storage is per thread and kept
+    // between commands (no handler runs another command)
+    static thread_local vector<string_view> comds; // commands
+    tokenize(comd, comds);
+
+    // handling commands checking that it should have at least one token
+    if (comds.empty()) 
+    {
+        reply(conn, "Invalid command");
+        return;
+    }
+    commandtimer timer(loadstats, comds[0]); // recorded on return
+
+    auto it = comdtable.find(comds[0]);
+    if (it == comdtable.end() || (it->second.internal && !conn->internal)) 
+    {
+        reply(conn, "Unrecognized command");
+        return;
+    }
+    const comdentry &ce = it->second; // command
+
+    // another shard's group: the client's tracker_info.txt does not match ours
+    if (ce.grouparg && ring.size() > 1 && !conn->internal && ce.grouparg < comds.size()) 
+    {
+        int owner = ring.owner(comds[ce.grouparg]); // shard
+        if (owner != trackershard) 
+        {
+            reply(conn, "WRONG_SHARD ", owner);
+            return;
+        }
+    }
+
+    // a user is created on its home shard only, and copied from there
+    if (!conn->internal && comds.size() > 1) 
+    {
+        int home = ring.owner(comds[1]); // shard
+        if (comds[0] == "create_user" && home != trackershard) 
+        {
+            reply(conn, "WRONG_SHARD ", home);
+            return;
+        }
+        if (comds[0] == "copy_user" && (home == trackershard || !fromshard(conn, home))) 
+        {
+            reply(conn, "------- Users are copied only from the trackers of their home shard ", home, " -------");
+            return;
+        }
+    }
+
+    // over budget: turned away before anything runs, the client tries again after the wait
+    if (!conn->internal) 
+    {
+        int64_t wait = limiter.admit(timer.slot, conn->budget, conn->user); // ms
+        if (wait) 
+        {
+            reply(conn, "RETRY_AFTER ", wait);
+            return;
+        }
+    }
+    if (!ce.mutating) 
+    {
+        ce.run(conn, comds, blob, bloblen);
+        return;
+    }
+
+    // standbys only change state through the primary's log
+    if (!isprimary && !conn->internal) 
+    {
+        reply(conn, "NOT_PRIMARY ", primaryno.load());
+        return;
+    }
+
+    // applying and logging as one step, failed commands are logged too since
+    // replay fails them the same way
+    lock_guard<mutex> lock(mutationmtx);
+    ce.run(conn, comds, blob, bloblen);
+    if (!conn->replaying) 
+    {
+        static thread_local string rec; // record, reused like comds
+        rec.clear();
+        put(rec, comds[0]);
+        for (size_t i = 1; i < comds.size(); i++) put(rec, ' ', comds[i]);
+        if (blob) 
+        {
+            rec += '\n';
+            rec.append(blob, bloblen);
+        }
+        uint64_t seq = trackerlog.append(rec);
+        if (!seq) 
+        {
+            // already applied and not durable: stopping before the reply goes out,
+            // so no client or standby sees a change the log does not have
+            logger.line(LOG_ERROR, "------- Unable to append to the log, stopping the tracker -------");
+            exit(1);
+        }
+        backlog.push(seq, rec); // on to the standbys
+    }
+}
+
+// whole store as one snapshot image, caller holds mutationmtx
+string snapshotimage(uint64_t seq) 
+{
+    char *buf = NULL; // image
+    size_t len = 0; // image size
+    FILE *fp = open_memstream(&buf, &len);
+    if (!fp) return "";
+    bool ok = snapshotdump(store, seq, trackerepoch, fp);
+    fclose(fp);
+    string image = ok ? string(buf, len) : string();
+    free(buf);
+    return image;
+}
+
+// writing a snapshot of the store and dropping the log records it covers
+// mutations wait only while the image is built in memory, writing and
+// fsyncing it happen without mutationmtx. records logged meanwhile are newer
+// than the image and stay in the log
+bool takesnapshot() 
+{
+    lock_guard<mutex> snaplock(snapshotmtx);
+    auto begin = chrono::steady_clock::now();
+    string image; // store at seq
+    uint64_t seq, cut; // last record and log size the image covers
+    {
+        lock_guard<mutex> lock(mutationmtx);
+        seq = trackerlog.lastseq();
+        cut = trackerlog.size();
+        image = snapshotimage(seq);
+    }
+    auto held = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    if (!snapshotsave(image, snapshotpath)) 
+    {
+        logger.line(LOG_ERROR, "------- Unable to write snapshot ", snapshotpath, " -------");
+        return false;
+    }
+    string().swap(image); // freeing image
+    {
+        lock_guard<mutex> lock(mutationmtx);
+        if (!trackerlog.dropfront(cut)) logger.line(LOG_WARN, "------- Unable to trim log, replay skips what the snapshot covers -------");
+    }
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    logger.line(LOG_INFO, "Snapshot written at log seq ", seq, " in ", ms, " ms (mutations held ", held, " ms)");
+    return true;
+}
+
+// loading snapshot and replaying newer log records, false if state is unreadable
+bool recoverstate(const string &base) 
+{
+    auto begin = chrono::steady_clock::now();
+    snapshotpath = base + ".snap";
+    uint64_t snapseq = 0, epoch = 0; // seq covered by snapshot and its term
+    if (!snapshotload(store, snapshotpath, snapseq, epoch)) 
+    {
+        logger.line(LOG_ERROR, "------- Snapshot ", snapshotpath, " is corrupt or of an older format, refusing to start -------");
+        return false;
+    }
+    if (!trackerlog.open(base + ".wal")) 
+    {
+        logger.line(LOG_ERROR, "------- Unable to open log ", base, ".wal -------");
+        return false;
+    }
+    trackerlog.setseq(snapseq);
+    trackerepoch = epoch;
+
+    connection replayconn(-1); // replies are dropped
+    replayconn.internal = true;
+    replayconn.replaying = true;
+    long long replayed = 0; // records applied
+    trackerlog.replay(snapseq, [&](uint64_t seq, string payload) 
+    {
+        managepeer(&replayconn, payload);
+        replayconn.outbuf.clear();
+        replayed++;
+    });
+
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+    logger.line(LOG_INFO, "Recovered ", store.peers.size(), " users, ", store.groups.size(), " groups, ", store.files.size(), " files", 
+                " (snapshot seq ", snapseq, ", ", replayed, " log records) in ", ms, " ms");
+    return true;
+}
+
+// syncing log every second and snapshotting periodically or when log grows big
+void persistloop() 
+{
+    int elapsed = 0; // seconds since last snapshot
+    while (true) 
+    {
+        this_thread::sleep_for(chrono::seconds(1));
+        trackerlog.sync();
+        elapsed++;
+        if (trackerlog.size() >= SNAPSHOT_LOG_BYTES || (elapsed >= SNAPSHOT_INTERVAL && trackerlog.size() > 0)) 
+        {
+            takesnapshot();
+            elapsed = 0;
+        }
+    }
+}
+
+// primary side: streaming the log to one standby on its own thread until it goes away
+// a standby on our term that is not too far behind catches up from the backlog,
+// anything else (new standby, other term, diverged history) gets a snapshot first
+void shiplog(int sock, int standbyno, uint64_t epoch, uint64_t seq) 
+{
+    int flags = fcntl(sock, F_GETFL, 0); // back to blocking writes
+    fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+    struct timeval tv = {5, 0}; // a stuck standby must not hold this thread forever
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    string image; // snapshot, when catching up from backlog is not possible
+    uint64_t sent; // last seq the standby has
+    {
+        lock_guard<mutex> lock(mutationmtx); // image and backlog position agree
+        sent = trackerlog.lastseq();
+        if (epoch == trackerepoch && seq <= sent && backlog.covers(seq, sent)) sent = seq;
+        else image = snapshotimage(sent);
+    }
+    logger.line(LOG_INFO, "******* Standby tracker ", standbyno, " attached, ", 
+                image.empty() ? "catching up from seq " : "sending snapshot at seq ", sent, " *******");
+
+    threadstats &counters = loadstats.mine(); // this stream's thread
+    bump(counters.streams);
+
+    framedsocket out; // stream
+    out.setsock(sock);
+    out.queue(FRAME_REPLY, "REPLICATING " + to_string(trackerno) + " " + to_string(trackerepoch) + " " + to_string(sent));
+    bool ok = out.flush();
+    if (!image.empty()) 
+    {
+        for (size_t off = 0; ok && off < image.size(); off += SNAPSHOT_CHUNK) 
+        {
+            ok = out.sendframe(FRAME_SNAPSHOT, image.substr(off, SNAPSHOT_CHUNK));
+        }
+        bump(counters.bytesout, image.size());
+        ok = ok && out.sendframe(FRAME_SNAPSHOT, "");
+        string().swap(image); // freeing image
+    }
+
+    while (ok) 
+    {
+        string batch; // log frames
+        if (!backlog.collect(sent, batch, REPL_HEARTBEAT_MS)) 
+        {
+            logger.line(LOG_WARN, "------- Standby tracker ", standbyno, " fell behind the backlog, resyncing -------");
+            break;
+        }
+        if (batch.empty()) appendlogframe(batch, 0, ""); // heartbeat
+        out.queueframes(batch);
+        ok = out.flush();
+        bump(counters.bytesout, batch.size());
+    }
+    bump(counters.streamsdone);
+    standbystreams--;
+    logger.line(LOG_WARN, "------- Standby tracker ", standbyno, " detached -------");
+    close(sock);
+}
+
+// connecting to a tracker at ip and port, -1 if unreachable
+int dialaddr(const string &ip, const string &port) 
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0); // socket
+    if (sock < 0) return -1;
+    struct sockaddr_in addr; // address
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port.c_str()));
+    struct timeval tv = {1, 0}; // connect timeout
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) 
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// proving to the tracker on the other end that we are one of its peers
+bool authtracker(framedsocket &out) 
+{
+    uint8_t type; // frame type
+    string payload; // reply
+    return out.sendframe(FRAME_COMMAND, "tracker_auth " + to_string(trackershard) + " " + trackersecret) && 
+           out.recvframe(type, payload) && type == FRAME_REPLY && payload.compare(0, 14, "AUTHENTICATED ") == 0;
+}
+
+// connecting to tracker no of our shard, -1 if unreachable
+int dialtracker(int no) 
+{
+    return dialaddr(trackeraddrs[no - 1].first, trackeraddrs[no - 1].second);
+}
+
+// sending a copy_user to the primary of shard, true once it is done there
+// (registered, or an older copy replaced). a standby answers NOT_PRIMARY and
+// the next tracker of the shard is tried
+bool sendtoshard(int shard, const string &comd) 
+{
+    for (auto &a : alltrackers) 
+    {
+        if (a.shard != shard) continue;
+        int sock = dialaddr(a.ip, a.port);
+        if (sock < 0) continue;
+        struct timeval tv = {REPL_TIMEOUT_SEC, 0}; // reply timeout
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        framedsocket out; // stream
+        out.setsock(sock);
+        uint8_t type; // frame type
+        string payload; // reply
+        bool got = authtracker(out) && out.sendframe(FRAME_COMMAND, comd) && out.recvframe(type, payload) && type == FRAME_REPLY;
+        close(sock);
+        if (got && payload.compare(0, 12, "USER_COPIED ") == 0) return true;
+    }
+    return false;
+}
+
+// sending queued user copies to their shards, one that cannot be reached
+// now goes to the back of the queue and is tried again after a pause
+void forwardloop() 
+{
+    while (true) 
+    {
+        pair<int, string> f; // shard, command
+        {
+            unique_lock<mutex> lock(forwardmtx);
+            forwardcv.wait(lock, [] { return !forwards.empty(); });
+            f = move(forwards.front());
+            forwards.pop_front();
+        }
+        if (sendtoshard(f.first, f.second)) continue;
+        logger.line(LOG_WARN, "------- Shard ", f.first, " unreachable, user copy retried -------");
+        this_thread::sleep_for(chrono::milliseconds(FORWARD_RETRY_MS));
+        lock_guard<mutex> lock(forwardmtx);
+        forwards.push_back(move(f));
+    }
+}
+
+// replacing our state with the primary's snapshot image
+// log is emptied first, so a crash in between leaves an older but consistent state
+bool installsnapshot(const string &image) 
+{
+    lock_guard<mutex> lock(mutationmtx);
+    store.clear();
+    uint64_t seq = 0, epoch = 0; // position of image
+    if (!snapshotparse(store, image.data(), image.size(), seq, epoch)) 
+    {
+        logger.line(LOG_ERROR, "------- Snapshot from primary is corrupt -------");
+        store.clear();
+        return false;
+    }
+    trackerepoch = epoch;
+    trackerlog.resetto(seq);
+    if (!snapshotwrite(store, seq, epoch, snapshotpath)) 
+    {
+        logger.line(LOG_ERROR, "------- Unable to write snapshot ", snapshotpath, " -------");
+    }
+    logger.line(LOG_INFO, "Installed snapshot from primary at log seq ", seq, ": ", store.peers.size(), " users, ", 
+                store.groups.size(), " groups, ", store.files.size(), " files");
+    return true;
+}
+
+// standby side: following tracker no while it is primary
+// -1 unreachable, 0 reachable but not primary, 1 followed it until the stream broke
+int followtracker(int no) 
+{
+    int sock = dialtracker(no);
+    if (sock < 0) return -1;
+    struct timeval tv = {REPL_TIMEOUT_SEC, 0}; // primary sends heartbeats well within this
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    framedsocket in; // stream
+    in.setsock(sock);
+    uint8_t type; // frame type
+    string payload; // frame
+    string req = "replicate " + to_string(trackerno) + " " + to_string(trackerepoch) + " " + to_string(trackerlog.lastseq());
+    if (!authtracker(in) || !in.sendframe(FRAME_COMMAND, req) || !in.recvframe(type, payload) || 
+        type != FRAME_REPLY || payload.compare(0, 12, "REPLICATING ") != 0) 
+    {
+        close(sock);
+        return 0;
+    }
+    primaryno = no;
+    logger.line(LOG_INFO, "======= Following primary tracker ", no, " =======");
+
+    connection replconn(-1); // records are logged here under the same seq
+    replconn.internal = true;
+    string image; // snapshot being received
+    while (in.recvframe(type, payload)) 
+    {
+        if (type == FRAME_SNAPSHOT) 
+        {
+            if (!payload.empty()) 
+            {
+                image += payload;
+                continue;
+            }
+            bool ok = installsnapshot(image);
+            string().swap(image);
+            if (!ok) break;
+        }
+        else if (type == FRAME_LOG && payload.size() >= 8) 
+        {
+            uint64_t seq; // record seq
+            memcpy(&seq, payload.data(), 8);
+            if (seq == 0) continue; // heartbeat
+            if (seq != trackerlog.lastseq() + 1) 
+            {
+                logger.line(LOG_WARN, "------- Log gap from primary (have ", trackerlog.lastseq(), ", got ", seq, "), resyncing -------");
+                break;
+            }
+            managepeer(&replconn, string_view(payload).substr(8)); // command and blob
+            replconn.outbuf.clear(); // nobody to reply to
+        }
+    }
+    close(sock);
+    primaryno = 0;
+    logger.line(LOG_WARN, "------- Lost primary tracker ", no, " -------");
+    return 1;
+}
+
+// taking over as primary with a new term
+// restarted: our own connections died with the old process, nobody is online
+void promote(bool restarted) 
+{
+    connection internal(-1);
+    internal.internal = true;
+    if (restarted) 
+    {
+        string comd = "tracker_restarted";
+        managepeer(&internal, comd);
+    }
+    // term in the high bits, tracker number keeps two takeovers apart
+    uint64_t epoch = (((trackerepoch >> 16) + 1) << 16) | (uint64_t)trackerno;
+    string comd = "tracker_promoted " + to_string(epoch);
+    managepeer(&internal, comd);
+    // heartbeats went to the old primary, everyone online gets a fresh lease
+    store.peers.readall([&](nameid u, client *peer) 
+    {
+        if (peer->connected) renewlease(peer);
+    });
+    primaryno = trackerno;
+    isprimary = true;
+    logger.line(LOG_INFO, "======= Tracker ", trackerno, " is now PRIMARY (epoch ", epoch, ", log seq ", trackerlog.lastseq(), ") =======");
+}
+
+// looking for a primary among the other trackers and following it, taking over
+// when none answers for long enough. tracker n waits n rounds, so the lowest
+// numbered live tracker steps up first and the others find it on their next round
+void followloop(bool restarted) 
+{
+    int misses = 0; // rounds without a primary
+    while (true) 
+    {
+        bool followed = false; // found and lost a primary this round
+        for (int no = 1; no <= (int)trackeraddrs.size() && !followed; no++) 
+        {
+            if (no != trackerno) followed = followtracker(no) == 1;
+        }
+        if (followed) 
+        {
+            misses = 0;
+            restarted = false; // state and online users came from the primary
+            continue;
+        }
+        if (++misses > trackerno) break;
+        this_thread::sleep_for(chrono::milliseconds(ELECTION_ROUND_MS));
+    }
+    promote(restarted);
+}
+
+// taking seeders with lapsed leases offline, once a second on the primary
+void leaseloop() 
+{
+    while (true) 
+    {
+        this_thread::sleep_for(chrono::seconds(1));
+        if (!isprimary) continue;
+        long long now = nowms();
+        vector<string> expired; // "name session"
+        store.peers.readall([&](nameid u, client *peer) 
+        {
+            if (peer->connected && peer->leaseuntil.load(memory_order_relaxed) <= now) 
+            {
+                expired.push_back(string(store.usernames.name(u)) + " " + to_string(peer->session));
+            }
+        });
+        for (auto &e : expired) 
+        {
+            connection internal(-1);
+            internal.internal = true;
+            string comd = "lease_expired " + e;
+            managepeer(&internal, comd);
+        }
+    }
+}
+
+// keeping the candidates still idle with when a sweep first saw them so,
+// and returning those that have been idle for the whole grace period
+vector<nameid> dueforgc(unordered_map<nameid, long long> &seen, const vector<nameid> &idle, long long now, long long grace) 
+{
+    unordered_map<nameid, long long> still; // idle this sweep too
+    vector<nameid> due; // to reclaim
+    for (nameid id : idle) 
+    {
+        auto it = seen.find(id);
+        long long since = it == seen.end() ? now : it->second;
+        if (now - since >= grace) due.push_back(id);
+        else still[id] = since;
+    }
+    seen.swap(still);
+    return due;
+}
+
+// one reaper sweep on the primary: reclaiming groups, then contents (which
+// may have lost their last group just now), through logged reclaim commands
+// that recheck under mutationmtx, then compacting. the store is only read
+// while looking, so commands keep running. a standby only compacts, it
+// reclaims what the primary logs. returns entries reclaimed
+size_t collectgarbage() 
+{
+    static mutex gcmtx; // one sweep at a time
+    static unordered_map<nameid, long long> idlegroups, idlefiles; // candidate to first seen idle (steady ms)
+    lock_guard<mutex> lock(gcmtx);
+    if (!isprimary) 
+    {
+        idlegroups.clear(); // a later term starts its grace periods afresh
+        idlefiles.clear();
+        gcidle = 0;
+        if (store.compact() + limiter.trim()) malloc_trim(0); // names it released while replaying
+        return 0;
+    }
+    long long grace = gcgrace.load() * 1000LL; // ms
+    uint64_t before = gcgroups.load() + gcfiles.load();
+    connection internal(-1);
+    internal.internal = true;
+
+    vector<nameid> idle; // idle right now
+    store.groups.readall([&](nameid g, groupentry &ge) 
+    {
+        if (ge.grp->participants.empty()) idle.push_back(g);
+    });
+    for (nameid g : dueforgc(idlegroups, idle, nowms(), grace)) 
+    {
+        string comd = "reclaim group " + string(store.groupnames.name(g));
+        managepeer(&internal, comd);
+    }
+    idle.clear();
+    store.files.readall([&](nameid f, FileMeta &fm) 
+    {
+        if (fm.idle()) idle.push_back(f);
+    });
+    for (nameid f : dueforgc(idlefiles, idle, nowms(), grace)) 
+    {
+        string comd = "reclaim file " + string(store.contents.name(f));
+        managepeer(&internal, comd);
+    }
+    gcidle = idlegroups.size() + idlefiles.size();
+
+    size_t reclaimed = gcgroups.load() + gcfiles.load() - before;
+    size_t shrunk = store.compact() + limiter.trim(); // tables, lists, names and user buckets
+    if (reclaimed || shrunk) malloc_trim(0); // freed heap back to the OS
+    if (reclaimed) logger.line(LOG_INFO, "Reclaimed ", reclaimed, " groups and contents, ", shrunk, " tables and lists shrunk, rss ", processstatus("VmRSS:"), " kB");
+    return reclaimed;
+}
+
+// reclaiming and compacting every GC_INTERVAL_SECONDS
+void gcloop() 
+{
+    while (true) 
+    {
+        this_thread::sleep_for(chrono::seconds(GC_INTERVAL_SECONDS));
+        collectgarbage();
+    }
+}
 
-// maps for tracking users, groups, files, and group-file
-unordered_map<string, client*> peers;   // peername to client
-unordered_map<string, group*> groups;   // group id to group
-unordered_map<string, unordered_set<string>> group_files; // group to files
-unordered_map<string, FileMeta> files;  // file to meta
+// event loop shared by a fixed set of worker threads
+int epollfd;        // epoll instance
+int listensock;     // listening socket
+const int MAX_EVENTS = 32; // events per epoll_wait
+const size_t MAX_PENDING_OUT = 4 * 1024 * 1024; // unsent reply bytes before a connection stops being read
+const size_t MAX_INBUF = FRAME_HEADER + MAX_FRAME; // one largest frame, whole frames are run as they complete
 
-// checking existence of group and user
-bool isgrouppresent(string str) 
+// making socket non blocking for edge triggered epoll
+bool setnonblocking(int sock) 
 {
-    return groups.find(str) != groups.end(); // checking group
+    int flags = fcntl(sock, F_GETFL, 0); // current flags
+    if (flags < 0) return false;
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
 }
 
-bool isuserpresent(string str) 
+// reply bytes queued on conn and not written yet
+size_t pendingout(connection *conn) 
 {
-    return peers.find(str) != peers.end(); // checking user
+    return conn->outbuf.size() - conn->outoff;
 }
 
-// for handling all commands from connected client
-void managepeer(int peersocket) 
+// re-arming oneshot connection, asking for writability only when a reply or event is pending
+// a paused connection (peer not reading its replies) waits for writability alone
+void rearm(connection *conn, bool paused) 
 {
-    string disconnecting_user; // user to disconnect
-    // main loop which read and process commands from peer
-    while (1) 
+    struct epoll_event ev;
+    ev.events = paused ? EPOLLOUT | EPOLLET | EPOLLONESHOT : EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    bool waiting; // events behind a full socket
     {
-        // incoming command from socket
-        char buff[512000];              // buffer
-        memset(buff, 0, sizeof(buff));  // clear buffer
-
-        int bytrd = read(peersocket, buff, sizeof(buff)); // read
-
-        if (bytrd == 0) 
-        {
-            cout << "Socket received 0 bytes: " << peersocket << endl;
-            
-            // on disconnect, transfer group ownership if required
-            if (!disconnecting_user.empty()) 
-            {
-                for (auto &gpair : groups) 
-                {
-                    group *grp = gpair.second;
-                    if (grp->groupmaster == disconnecting_user) 
-                    {
-                        grp->deluser(disconnecting_user); // removing master
-                    }
-                }
-            }
-            return;
-        }
-        
-        cout << "Incoming command from socket " << peersocket << ": " << buff << endl;
+        lock_guard<mutex> lock(conn->push.mtx);
+        waiting = !conn->push.buf.empty();
+    }
+    if (conn->outoff < conn->outbuf.size() || waiting) ev.events |= EPOLLOUT;
+    ev.data.ptr = conn;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
 
-        // tokenizse command string into args
-        vector<string> comds;               // commands
-        char *token = strtok(buff, " ");    // spliting
-        
-        while (token != NULL) 
+// writing as much of pending reply as socket takes, false on error
+// pushed events share the socket, they go out between replies and never
+// inside one, so the lock keeps other threads' events off the wire meanwhile
+bool flushconn(connection *conn) 
+{
+    pushqueue &pq = conn->push; // events
+    lock_guard<mutex> lock(pq.mtx);
+    while (true) 
+    {
+        if (!pq.replying) 
         {
-            comds.push_back(token); // adding
-            token = strtok(NULL, " ");
+            ssize_t n = pq.writeout(); // events queued since last time
+            if (n < 0) return false;
+            bump(loadstats.mine().bytesout, n);
+            if (!pq.buf.empty()) return true; // socket full, wait for EPOLLOUT
         }
-        
-        // handling commands checking that it should have at least one token
-        if (comds.empty()) 
+        if (conn->outoff == conn->outbuf.size()) break;
+        ssize_t sent = send(conn->fd, conn->outbuf.data() + conn->outoff, conn->outbuf.size() - conn->outoff, MSG_NOSIGNAL);
+        if (sent > 0) 
         {
-            string msg = "Invalid command";
-            send(peersocket, msg.c_str(), msg.size(), 0);
+            conn->outoff += sent; // adding sent
+            bump(loadstats.mine().bytesout, sent);
+            pq.replying = conn->outoff < conn->outbuf.size();
             continue;
         }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true; // socket full, wait for EPOLLOUT
+        return false;
+    }
+    conn->outbuf.clear(); // all written
+    conn->outoff = 0;
+    return true;
+}
 
-        // tracking user for disconnect  for group ownership transfer
-        if ((comds[0] == "login" || comds[0] == "logout") && comds.size() > 1) 
-        {
-            disconnecting_user = comds[1]; // setting user
-        }
+void closeconn(connection *conn) 
+{
+    bump(loadstats.mine().closed);
+    notifier.drop(&conn->push); // no event touches it after this
+    peerdisconnected(conn);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    delete conn;
+}
 
-        // create_user <username> <passcode>
-        if (comds[0] == "create_user") 
+// accepting every pending connection then re-arming listener
+void acceptpeers() 
+{
+    while (true) 
+    {
+        int incomsock = accept(listensock, NULL, NULL); // incoming socket
+        if (incomsock < 0) 
         {
-            if (comds.size() != 3) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (isuserpresent(comds[1])) 
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) 
             {
-                string msg = "-----Cannot create user: ID already in use.-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else 
-            {
-                client* peer = new client(comds[1], comds[2]); // new user
-                peers[comds[1]] = peer; // add user
-                string msg = "***** ID number " + comds[1] + " registered successfully! ******";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-                cout << "****** ID " << comds[1] << " has been registered as a new user. ******" << endl;
+                logger.line(LOG_ERROR, "------- Unable to accept incoming connection -------");
             }
+            break;
         }
-
-        // login <username> <passcode> <ip> <port>
-        else if (comds[0] == "login") 
+        if (!setnonblocking(incomsock)) 
         {
-            if (comds.size() < 5) 
-            {
-                string msg = "-----Invalid Arguments for login-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            }
-            else if (!isuserpresent(comds[1])) 
-            {
-                string msg = "------ User ID " + comds[1] + " is not registered ------";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (peers[comds[1]]->passcode != comds[2]) 
-            {
-                string msg = "------ Authentication failed: incorrect passcode for ID " + comds[1] + " ------";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else 
-            {
-                peers[comds[1]]->login(comds[3], comds[4]);
-                string msg = "Successful Login for User ID " + comds[1] + "! ******\n";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            }
+            close(incomsock);
+            continue;
         }
+        logger.line(LOG_INFO, "******* Client accepted at socket: ", incomsock, " ******");
 
-        // logout <username>
-        else if (comds[0] == "logout") 
+        connection *conn = new connection(incomsock); // new connection
+        bump(loadstats.mine().opened);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, incomsock, &ev) < 0) 
         {
-            if (comds.size() < 2) 
-            {
-                string msg = "-----Invalid Arguments-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (!isuserpresent(comds[1])) 
-            {
-                string msg = "------- No such User ID: " + comds[1] + " ------";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else 
-            {
-                peers[comds[1]]->logout(); // logout
-                string msg = "***** User ID " + comds[1] + " logged out successfully ******";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            }
+            close(incomsock);
+            delete conn;
+            bump(loadstats.mine().closed);
         }
+    }
 
-        // create_group <groupid> <owner_username>
-        else if (comds[0] == "create_group") 
-        {
-            if (comds.size() < 3) 
-            {
-                string msg = "-----Invalid Arguments-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (!isuserpresent(comds[2])) 
-            {
-                string msg = "------- No such User ID: " + comds[2] + " ------";
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (isgrouppresent(comds[1])) 
-            {
-                string msg = "------- This Group ID is already taken ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                group * initgrp = new group(comds[1], comds[2]); // creating new group
-                groups[comds[1]] = initgrp; // adding group
-                string msg = "******* Group creation successful. Assigned ID: " + comds[1] + " *******";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            }
-        }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = NULL; // listener
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, listensock, &ev);
+}
 
-        // join_group <groupid> <username>
-        else if (comds[0] == "join_group") 
+// running every complete frame in inbuf in place, a partial one stays buffered
+// for next read. stops early while too many replies wait to be written
+void runframes(connection *conn, bool &closed) 
+{
+    size_t off = 0; // consumed bytes
+    uint8_t type; // frame type
+    string_view comd; // command, points into inbuf
+    while (pendingout(conn) <= MAX_PENDING_OUT) 
+    {
+        framestatus st = nextframe(conn->inbuf, off, type, comd);
+        if (st == FRAME_PARTIAL) break;
+        if (st == FRAME_TOOBIG) 
         {
-            if (comds.size() < 3) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (!isuserpresent(comds[2])) 
-            {
-                string msg = "------- No such User ID: " + comds[2] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            }
-            else if (!isgrouppresent(comds[1])) 
-            {
-                string msg = "------- No such group ID: " + comds[1] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (groups[comds[1]]->partofgroup(comds[2])) 
-            {
-                string msg = "------- You have already joined this group: " + comds[1] + " -------";
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                groups[comds[1]]->applicants.insert(comds[2]); // add request
-                string msg = "******* Request to join group " + comds[1] + " has been sent ******";
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            }
+            logger.line(LOG_WARN, "------- Oversized frame on socket ", conn->fd, ", closing -------");
+            closed = true;
+            break;
         }
-
-        // leave_group <groupid> <username>
-        else if (comds[0] == "leave_group") 
+        if (type == FRAME_REQUEST) 
         {
-            if (comds.size() < 3) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!isuserpresent(comds[2])) 
-            {
-                string msg = "------- No such User ID: " + comds[2] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else if (!isgrouppresent(comds[1])) 
-            {
-                string msg = "------- No such group ID: " + comds[1] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!groups[comds[1]]->partofgroup(comds[2])) 
-            {
-                string msg = "------ Access denied. You are not part of Group ID " + comds[1] + " -------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                groups[comds[1]]->deluser(comds[2]); // removing user
-                string msg = "****** Left group successfully. ID: " + comds[1] + " ******";
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            }
-        }
+            if (!taggedid(comd, conn->reqid)) continue; // no id, nothing to answer to
+            comd.remove_prefix(REQUEST_ID_SIZE);
+            conn->tagged = true;
+            conn->replies = 0;
+            managepeer(conn, comd);
+            if (conn->replies == 0 && !conn->standbyno) reply(conn, ""); // every request completes
+            conn->tagged = false;
+        } 
+        else if (type == FRAME_COMMAND) managepeer(conn, comd);
+        else continue; // ignoring unknown frames
+        if (conn->standbyno) break; // rest of this stream is the log
+    }
+    conn->inbuf.erase(0, off); // dropping consumed frames
+}
 
-        // list_requests <groupid> <owner_username>
-        else if (comds[0] == "list_requests") 
-        {
-            if (comds.size() < 3) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!isuserpresent(comds[2])) 
-            {
-                string msg = "------- No such User ID: " + comds[2] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!isgrouppresent(comds[1])) 
-            {
-                string msg = "------- No such group ID: " + comds[1] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (groups[comds[1]]->groupmaster != comds[2]) 
-            {
-                string msg = "------ Access denied. You are not the group owner of ID " + comds[1] + " -------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                string msg = ""; // message
-                for (const auto &user : groups[comds[1]]->applicants) msg += user + "\n"; // add requests
-                if (msg == "") msg = "------- Group ID " + comds[1] + " has no pending join requests -------"; // no requests
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            }
-        }
+// reading what is available, running commands and flushing replies in rounds
+// so neither buffer outgrows its cap however much the peer pipelines. a peer
+// that does not read its replies is paused: no reads until they are written
+// oneshot arming makes sure only one worker owns a connection at a time
+void serviceconn(connection *conn, uint32_t events) 
+{
+    bool closed = (events & EPOLLERR) != 0; // socket error
+    bool paused = false; // replies over the cap, waiting for the peer
+    char buff[READ_CHUNK]; // read buffer
 
-        // accept_request <groupid> <applicant_username> <owner_username>
-        else if (comds[0] == "accept_request") 
+    // edge triggered, so draining till EAGAIN unless paused
+    while (!closed) 
+    {
+        runframes(conn, closed); // what is buffered, as far as output allows
+        if (closed || conn->standbyno) break;
+        if (pendingout(conn) > MAX_PENDING_OUT) 
         {
-            if (comds.size() < 4) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!isuserpresent(comds[2])) 
-            {
-                string msg = "------- No such User ID: " + comds[2] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!isgrouppresent(comds[1])) 
-            {
-                string msg = "------- No such group ID: " + comds[1] + " ------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (groups[comds[1]]->groupmaster != comds[3]) 
-            {
-                string msg = "------ Access denied. You are not the group owner of ID " + comds[1] + " -------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else if (!groups[comds[1]]->isapplicant(comds[2])) 
-            {
-                string msg = "------- This user (ID: " + comds[2] + ") has no pending requests -------"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                groups[comds[1]]->acceptreq(comds[2]); // accept
-                string msg = "******* Approval granted for User ID: " + comds[2] + " *******"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            }
+            if (!flushconn(conn)) closed = true;
+            else if (pendingout(conn) > MAX_PENDING_OUT) paused = true; // socket full
+            if (closed || paused) break;
+            continue; // more buffered frames may run now
         }
-
-        // list_groups
-        else if (comds[0] == "list_groups") 
+        size_t room = min(sizeof(buff), MAX_INBUF - conn->inbuf.size()); // runframes leaves less than a frame
+        ssize_t bytrd = read(conn->fd, buff, room); // read
+        if (bytrd > 0) 
         {
-            string msg = "############### Available groups on the network ###############";
-            for (auto it = groups.begin(); it != groups.end(); it++) 
-            {
-                msg += "\n" + it->first; // adding group
-            }
-            if (msg == "") msg = "-------- Currently, no groups are available. -------"; // no groups are there
-            send(peersocket, msg.c_str(), msg.size(), 0);
+            conn->inbuf.append(buff, bytrd); // adding
+            bump(loadstats.mine().bytesin, bytrd);
+            continue;
         }
+        if (bytrd == 0) closed = true; // peer closed
+        else if (errno == EINTR) continue;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK) closed = true;
+        break;
+    }
 
-    // upload_file <gid> <filename> <filePath>
-        else if (comds[0] == "upload_file") 
-        {
-            if (comds.size() < 4) 
-            {
-                string msg = "-----Invalid Arguments for upload_file-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else 
-            {
-                string gid = comds[1]; // group id
-                string fname = comds[2]; // file name
-                string uname = comds[3]; // user name
-                long long fsize = atoll(comds[4].c_str()); // file size
-                string fhash = comds[5]; // file hash
-                int num_pieces = stoi(comds[6]); // pieces
-
-                if (!isgrouppresent(gid)) 
-                {
-                    string msg = "------- No such group ID: " + gid + " ------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (!isuserpresent(uname) || !groups[gid]->partofgroup(uname)) 
-                {
-                    string msg = "------ You are not part of Group ID " + gid + " -------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else 
-                {
-                    // read piece hashes from comds[7...]
-                    FileMeta &fm = files[fname]; // file meta
-                    fm.size = fsize; // seting size
-                    fm.fullhash = fhash; // seting hash
-                    fm.num_pieces = num_pieces; // seting pieces
-                    fm.piece_hashes.clear(); // clearing hashes
-                    for (int i = 0; i < num_pieces; ++i) 
-                    {
-                        if ((int)comds.size() > 7 + i)
-                        {
-                            fm.piece_hashes.push_back(comds[7 + i]); // adding hash
-                        }
-                        else 
-                        {
-                            fm.piece_hashes.push_back(string()); // empty
-                        }
-                    }
-                    fm.peers.insert(uname); // adding peer
-                    group_files[gid].insert(fname); // adding file
+    if (conn->standbyno && !closed) 
+    {
+        // standby stream gets its own thread, off the event loop
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        notifier.drop(&conn->push);
+        thread(shiplog, conn->fd, conn->standbyno, conn->standbyepoch, conn->standbyseq).detach();
+        delete conn;
+        bump(loadstats.mine().closed); // counted as a standby stream from here
+        return;
+    }
 
-                    string msg = "******* File " + fname + " uploaded to group " + gid + " successfully *******"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                    cout << "Tracker: Registered file " << fname << " size " << fsize << " pieces " << num_pieces << endl; 
-                }
-            }
-        }
+    if (!closed && !flushconn(conn)) closed = true;
+    if (closed) 
+    {
+        if (conn->standbyno) standbystreams--; // stream was never started
+        flushconn(conn); // last reply if peer only half closed
+        closeconn(conn);
+        return;
+    }
+    rearm(conn, paused);
+}
 
-        // list_files <gid>
-        else if (comds[0] == "list_files") 
+// worker thread running the event loop
+void eventloop() 
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (true) 
+    {
+        int n = epoll_wait(epollfd, events, MAX_EVENTS, -1); // wait
+        if (n < 0) 
         {
-            if (comds.size() < 3) 
-            {
-                string msg = "-----Invalid Arguments-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                string gid = comds[1]; // group id
-                string uname = comds[2]; // user name
-                if (!isgrouppresent(gid)) 
-                {
-                    string msg = "------- No such group ID: " + gid + " ------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (!isuserpresent(uname) || !groups[gid]->partofgroup(uname)) 
-                {
-                    string msg = "------ Access denied. You are not part of Group ID " + gid + " -------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else 
-                {
-                    string msg;
-                    if (group_files.find(gid) == group_files.end() || group_files[gid].empty()) 
-                    {
-                        msg = "------- No files uploaded in group " + gid + " -------"; // no files
-                    } 
-                    else 
-                    {
-                        msg = "######## Files in Group " + gid + " ########\n";
-                        for (const auto &fname : group_files[gid]) 
-                        {
-                            FileMeta &fm = files[fname]; // file meta
-                            msg += fname + " SIZE:" + to_string(fm.size) + " PIECES:" + to_string(fm.num_pieces) + "\n"; // adding file
-                        }
-                    }
-                    send(peersocket, msg.c_str(), msg.size(), 0);
-                }
-            }
+            if (errno == EINTR) continue;
+            logger.line(LOG_ERROR, "------- epoll_wait failed -------");
+            return;
         }
-
-        // download_file <gid> <filename> <dest path>
-        // file metadata and list of seeders
-        else if (comds[0] == "download_file") 
+        for (int i = 0; i < n; i++) 
         {
-            if (comds.size() < 4) 
-            {
-                string msg = "-----Invalid Arguments for download_file-----";
-                send(peersocket, msg.c_str(), msg.size(), 0);
-            } 
-            else 
-            {
-                string gid = comds[1]; // group id
-                string fname = comds[2]; // file name
-                string uname = comds[3]; // user name
-
-                if (!isgrouppresent(gid)) 
-                {
-                    string msg = "------- No such group ID: " + gid + " ------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (!isuserpresent(uname) || !groups[gid]->partofgroup(uname)) 
-                {
-                    string msg = "------ Access denied. You are not part of Group ID " + gid + " -------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (group_files[gid].find(fname) == group_files[gid].end()) 
-                {
-                    string msg = "------- No such file in group " + gid + " -------"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else 
-                {
-                    FileMeta &fm = files[fname]; // file meta
-                    string msg = "FILE " + fname + " SIZE " + to_string(fm.size) + " HASH " + fm.fullhash + " PIECES " + to_string(fm.num_pieces) + " PIECE_HASHES";
-                    for (auto &h : fm.piece_hashes)
-                    {
-                        msg += " " + h; // adding hashes
-                    }
-                    msg += "\nPEERS\n";
-                    
-                    for (const string &peer : fm.peers) 
-                    {
-                        if (isuserpresent(peer) && peers[peer]->connected) 
-                        {
-                            msg += peer + " " + peers[peer]->hostip + " " + peers[peer]->hostport + "\n"; // add peer
-                        }
-                    }
-                    msg += "\n";
-                    send(peersocket, msg.c_str(), msg.size(), 0);
-                }
-            }
+            if (events[i].data.ptr == NULL) acceptpeers(); // listener
+            else serviceconn((connection *)events[i].data.ptr, events[i].events);
         }
+    }
+}
 
-        // file_downloaded <gid> <filename> <peername>
-        // will notify tracker that peer completed download and can now serve file
-        else if (comds[0] == "file_downloaded") 
+// console "limit", "limit <conn_rate> <user_rate>" or "limit cost <command> <units>",
+// showing or changing command budgets. a rate of 0 turns that limit off
+void setlimits(const string &inp) 
+{
+    vector<string_view> args; // rates, or command and cost
+    tokenize(inp, args);
+    if (args.size() == 4 && args[1] == "cost") 
+    {
+        if (!limiter.setcost(args[2], (int)tonum(args[3]))) 
         {
-            if (comds.size() != 4) 
-            {
-                string msg = "-----Invalid Arguments for file_downloaded-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } 
-            else 
-            {
-                string gid = comds[1]; // group id
-                string filename = comds[2]; // file name
-                string peername = comds[3]; // peer name
-
-                if (groups.find(gid) != groups.end() && groups[gid]->participants.find(peername) != groups[gid]->participants.end()) 
-                {
-                    if (group_files.find(gid) != group_files.end() && group_files[gid].find(filename) != group_files[gid].end()) 
-                    {
-                        if (peers.find(peername) != peers.end()) 
-                        {
-                            peers[peername]->filmaptopath[filename] = filename; // adding file
-                            if (files.find(filename) != files.end()) 
-                            {
-                                files[filename].peers.insert(peername); // adding peer
-                            }
-                            string msg = "SUCCESS: Peer " + peername + " registered as seeder for " + filename;
-                            send(peersocket, msg.c_str(), msg.size(), 0); 
-                        } 
-                        else 
-                        {
-                            string msg = "ERROR: Peer not found"; 
-                            send(peersocket, msg.c_str(), msg.size(), 0); 
-                        }
-                    } 
-                    else 
-                    {
-                        string msg = "ERROR: File not found in group"; 
-                        send(peersocket, msg.c_str(), msg.size(), 0); 
-                    }
-                } 
-                else 
-                {
-                    string msg = "ERROR: Group not found or peer not member"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                }
-            }
+            cout << "-----No such command: " << args[2] << "-----" << endl;
+            return;
         }
+    } 
+    else if (args.size() == 3) 
+    {
+        limiter.connrate = max(0, (int)tonum(args[1]));
+        limiter.userrate = max(0, (int)tonum(args[2]));
+    } 
+    else if (args.size() != 1) 
+    {
+        cout << "-----Invalid Arguments-----" << endl;
+        return;
+    }
+    cout << "Limits " << limiter.describe() << endl;
+}
 
-        // stop_share <gid> <filename> <peername>
-        // removing peer from file's seeder list for group
-        else if (comds[0] == "stop_share") 
-        {
-            if (comds.size() != 4) 
-            {
-                string msg = "-----Invalid Arguments for stop_share-----"; 
-                send(peersocket, msg.c_str(), msg.size(), 0); 
-            } else {
-                string gid = comds[1]; // group id
-                string filename = comds[2]; // file name
-                string peername = comds[3]; // peer name
-                if (!isgrouppresent(gid)) 
-                {
-                    string msg = "ERROR: Group not found"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (!isuserpresent(peername) || groups[gid]->participants.find(peername) == groups[gid]->participants.end()) 
-                {
-                    string msg = "ERROR: Peer not found or not member of group"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (group_files[gid].find(filename) == group_files[gid].end()) 
-                {
-                    string msg = "ERROR: File not found in group"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else if (files.find(filename) == files.end()) 
-                {
-                    string msg = "ERROR: File metadata not found"; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                } 
-                else 
-                {
-                    files[filename].peers.erase(peername); // removing peer
-                    if (peers.find(peername) != peers.end()) 
-                    {
-                        peers[peername]->filmaptopath.erase(filename); // removing file
-                    }
-                    string msg = "SUCCESS: Peer " + peername + " stopped sharing " + filename + " in group " + gid; 
-                    send(peersocket, msg.c_str(), msg.size(), 0); 
-                }
-            }
-        }
+// console "log <level> [sample] [rate]", changing what the tracker logs
+void setlogging(const string &inp) 
+{
+    static const char *levels[] = {"error", "warn", "info", "debug"};
+    vector<string_view> args; // level, sample, rate
+    tokenize(inp, args);
+    int lv = -1; // level asked
+    for (int i = 0; i < 4; i++) if (args.size() > 1 && args[1] == levels[i]) lv = i;
+    if (lv < 0) 
+    {
+        cout << "-----Invalid Arguments-----" << endl;
+        return;
+    }
+    logger.level = lv;
+    if (args.size() > 2) logger.commandsample = max(1, (int)tonum(args[2]));
+    if (args.size() > 3) logger.commandrate = max(0, (int)tonum(args[3]));
+    cout << "Logging " << levels[lv] << ", command lines 1 in " << logger.commandsample << ", at most " << logger.commandrate << "/s per thread" << endl;
+}
 
-        // unrecogniszed command
-        else 
-        {
-            string msg = "Unrecognized command"; 
-            send(peersocket, msg.c_str(), msg.size(), 0); 
-        }
+// gc [grace_seconds], a reaper sweep now
+void rungc(const string &inp) 
+{
+    vector<string_view> args; // grace
+    tokenize(inp, args);
+    if (args.size() > 1) gcgrace = max(0, (int)tonum(args[1]));
+    if (!isprimary) 
+    {
+        cout << "------- Not primary, standbys reclaim what the primary logs -------" << endl;
+        return;
+    }
+    size_t reclaimed = collectgarbage();
+    cout << "Reclaimed " << reclaimed << " groups and contents, " << gcidle << " idle within the grace period of " << gcgrace << " s" << endl;
+}
+
+// printing the load report every seconds
+void statsloop(int seconds) 
+{
+    while (true) 
+    {
+        this_thread::sleep_for(chrono::seconds(seconds));
+        cout << "------- Tracker stats -------\n" << statsreport() << "-----------------------------" << endl;
     }
 }
 
 int main(int argc, char *argv[]) 
 {
-    if (argc != 3) 
+    // tracker_info.txt tracker_no [stats_seconds]
+    if (argc != 3 && argc != 4) 
     {
         cout << "-----Invalid Arguments-----" << endl;
         return 0;
     }
 
-    // reading tracker IP and port from config file
-    FILE *filconfig = fopen(argv[1], "r"); // opening file
-    if (!filconfig) 
+    // reading every tracker's IP, port and shard from config file, tracker_no picks our line
+    vector<trackeraddr> addrs = readtrackerinfo(argv[1]); // every line
+    if (addrs.empty()) 
     { 
         cout << "Failed to open tracker info file" << endl; 
         return 0; 
     } 
 
-    char ipbuf[128], portbuf[32]; // buffers
-    if (fscanf(filconfig, "%127s %31s", ipbuf, portbuf) != 2) 
+    int lineno = atoi(argv[2]); // this tracker
+    if (lineno < 1 || lineno > (int)addrs.size()) 
     { 
-        cout << "Failed to read tracker info" << endl; 
-        fclose(filconfig); 
+        cout << "Failed to read tracker info for tracker " << argv[2] << endl; 
         return 0; 
     } 
+    string serverip = addrs[lineno - 1].ip; // setting ip
+    string serverport = addrs[lineno - 1].port; // setting port
+
+    // trackers take replicate and copy_user only from peers that know the secret
+    ifstream secretfile(SECRET_FILE); // first word is the secret
+    secretfile >> trackersecret;
+    if (addrs.size() > 1 && trackersecret.empty()) 
+    {
+        cout << "Failed to read the tracker secret from " << SECRET_FILE << endl;
+        return 0;
+    }
 
-    fclose(filconfig); // closing file
-    string serverip = ipbuf; // setting ip
-    string serverport = portbuf; // setting port
+    // the trackers of our shard replicate each other, numbered in file order
+    ring.build(addrs);
+    trackershard = addrs[lineno - 1].shard;
+    alltrackers = addrs;
+    for (int i = 0; i < (int)addrs.size(); i++) 
+    {
+        if (addrs[i].shard != trackershard) continue;
+        trackeraddrs.push_back({addrs[i].ip, addrs[i].port}); // adding tracker
+        if (i == lineno - 1) trackerno = trackeraddrs.size();
+    }
 
     // TCP socket
     int serversock; // socket
@@ -739,20 +2799,39 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    // log lines go out from here on through the drain thread, and whatever
+    // is still queued when the process exits is written then
+    logger.start();
+    atexit([]() { logger.drain(); });
+
     // server startup info and available commands
     cout << "\n=========================================\n"; 
     cout << "          TRACKER SERVER STARTED         \n"; 
     cout << "=========================================\n"; 
     cout << "Listening on IP: " << serverip << "  Port: " << serverport << endl; 
+    cout << "Tracker " << trackerno << " of " << trackeraddrs.size() << endl; 
+    if (ring.size() > 1) cout << "Shard " << trackershard << " of " << ring.size() << endl; 
     cout << "Tracker is now running...\n"; 
     cout << "-----------------------------------------\n"; 
     cout << "Available Tracker Commands (from console):\n"; 
     cout << "   quit   -> Stop the tracker server\n"; 
+    cout << "   stats  -> Print load statistics\n"; 
+    cout << "   log <error|warn|info|debug> [sample] [rate] -> Log level, 1 in sample command lines, at most rate/s per thread\n"; 
+    cout << "   limit [<conn_rate> <user_rate>] | limit cost <command> <units> -> Command budgets, units/s (0 = no limit)\n"; 
+    cout << "   gc [grace_seconds] -> Reclaim idle groups and contents now, optionally setting the grace period\n"; 
     cout << "-----------------------------------------\n\n"; 
 
-    int incomsock; // incoming socket
-    vector<thread> peerss; // threads
-    int length = sizeof(serveradd);
+    // state from previous runs, before accepting anyone
+    if (!recoverstate("tracker" + string(argv[2]))) 
+    {
+        return 0;
+    }
+    thread persist_thread(persistloop); // log sync and snapshots
+    persist_thread.detach(); // detach
+    thread(leaseloop).detach(); // seeder lease expiry
+    thread(gcloop).detach(); // reclaiming idle groups and contents
+    if (ring.size() > 1) thread(forwardloop).detach(); // copying new users to the other shards
+    if (argc == 4 && atoi(argv[3]) > 0) thread(statsloop, atoi(argv[3])).detach(); // periodic stats dump
 
     // thread to handle console input 
     thread exit_thread([]() 
@@ -763,28 +2842,49 @@ int main(int argc, char *argv[])
             getline(cin, inp);
             if (inp == "quit")
             {
+                takesnapshot(); // fast restart next time
                 exit(0);
             } 
+            if (inp == "stats") cout << statsreport() << flush;
+            if (inp.compare(0, 4, "log ") == 0) setlogging(inp);
+            if (inp == "limit" || inp.compare(0, 6, "limit ") == 0) setlimits(inp);
+            if (inp == "gc" || inp.compare(0, 3, "gc ") == 0) rungc(inp);
         }
     });
     exit_thread.detach(); // detach
 
-    // handle incoming client connections
-    while (1) 
+    // event loop for client connections
+    listensock = serversock;
+    epollfd = epoll_create1(0); // epoll instance
+    if (epollfd < 0 || !setnonblocking(listensock)) 
     {
-        if ((incomsock = accept(serversock, (struct sockaddr *)&serveradd, (socklen_t *)&length)) < 0) 
-        {
-            cout << "------- Unable to accept incoming connection -------" << endl;
-            continue;
-        }
-        cout << "******* Client accepted at socket: " << incomsock << " ******" << endl;
-        peerss.push_back(thread(managepeer, incomsock)); // adding thread
+        logger.line(LOG_ERROR, "------- Unable to start event loop -------");
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = NULL; // listener
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, listensock, &ev);
+
+    // finding our role, standbys keep following (and electing) in the background
+    if (trackeraddrs.size() == 1) promote(true);
+    else thread(followloop, true).detach();
+
+    // small fixed set of workers, independent of number of clients
+    int threadsno = thread::hardware_concurrency(); // number of threads
+    if (threadsno < 2) threadsno = 2;
+    if (threadsno > 8) threadsno = 8;
+    workerthreads = threadsno;
+    vector<thread> workers; // workers
+    for (int i = 0; i < threadsno; i++)
+    {
+        workers.emplace_back(eventloop); // start threads
     }
 
-    // join all peer threads before exiting
-    for (int i = 0; i < peerss.size(); i++)
+    // join all worker threads before exiting
+    for (size_t i = 0; i < workers.size(); i++)
     {
-        peerss[i].join(); // join
+        workers[i].join(); // join
     }
     return 0;
 }